@@ -14,9 +14,6 @@
 #define DEF(a)     { a, {
 #define EDEF       { -1, -1 } } },
 
-#define OPER_FLAG  0x10000000
-#define OPER(a)    (a | OPER_FLAG)
-
 symtable sym[]=
 {
   DEF("aax")
@@ -743,6 +740,9 @@ int nmap;
 int address;
 int cur_line;
 int max_line;
+static int line_alloc = 0;
+static int macro_alloc = 0;
+static int file_alloc = 0;
 int enum_val;
 
 int eval_addr = 0;
@@ -818,7 +818,7 @@ int main(int argc, char **argv)
     strcpy(fext, "ml");
   fnmerge(oname, name, fext);
 
-  macro = (Macro**)malloc(sizeof(Macro*));
+  macro = (Macro**)growArray(NULL, sizeof(Macro*), 1, macro_alloc);
   macro[0] = NULL;
 
   lib = (LabelList**)malloc(sizeof(LabelList*));
@@ -941,7 +941,7 @@ int main(int argc, char **argv)
     error_state = 0;
     reloc_hi = 0;
 
-    file = (File**)malloc(sizeof(File*));
+    file = (File**)growArray(NULL, sizeof(File*), 1, file_alloc);
     file[0] = NULL;
 
     cf = AddFile(oname);
@@ -1060,6 +1060,9 @@ int main(int argc, char **argv)
   for(i=0; file[i]; i++)
     file[i]->output();
 
+  if(verbose)
+    arena.report(stderr);
+
   exit(0);
 }
 
@@ -1080,7 +1083,7 @@ void readFile(char* fname)
     exit(1);
   }
 
-  pfname = strcreate(fname);
+  pfname = arena.intern(fname);
 
   while(! feof(fi)) {
     if(strlen(buf) == 0) {
@@ -1102,10 +1105,7 @@ void readFile(char* fname)
       }
       else if( (j = findMacro(li.Command())) >= 0) {
 	k = macro[j]->lineCount();
-	if(max_line == 0)
-	  line = (Line**)malloc(sizeof(Line*) * k);
-	else
-	  line = (Line**)realloc(line, sizeof(Line*) * (max_line+k));
+	line = (Line**)growArray(line, sizeof(Line*), max_line+k, line_alloc);
 
 	macro[j]->putLines(fline, &line[max_line], li.Argument(), li.Label());
 
@@ -1113,10 +1113,7 @@ void readFile(char* fname)
       }
       else {
 	++max_line;
-	if(max_line == 1)
-	  line = (Line**)malloc(sizeof(Line*));
-	else
-	  line = (Line**)realloc(line, sizeof(Line*)*max_line);
+	line = (Line**)growArray(line, sizeof(Line*), max_line, line_alloc);
 
 	line[max_line-1] = new Line;
 	line[max_line-1]->copy(fline, &li);
@@ -1136,7 +1133,7 @@ File* AddFile(char *name)
   register int i;
 
   for(i=0; file[i]; i++);
-  file = (File**)realloc(file, sizeof(File*) * (i+2));
+  file = (File**)growArray(file, sizeof(File*), i+2, file_alloc);
   file[i] = new File(name);
   file[i+1] = NULL;
 
@@ -1283,118 +1280,9 @@ void getString(char *arg, char *str)
 
 int evaluate(char *arg)
 {
-  register int i, j;
-  int v;
-  int smax, stream[512];
-  int ec, ev[512];
-  char *r;
-
-  eval_addr = 0;
-  eval_lo = -1;
-
-  while((*arg == ' ' || *arg == TAB) && *arg != 0)
-    ++arg;
-
-  if(! strcmp(arg, "*")) {
-    v = address;
-    eval_addr = v >> RELOC_BIT;    // =False if <$1000000, otherwise table number
-    return v;
-  }
-
-  if(*arg == '-' || *arg == '+' || *arg == '%')
-    if(! isdigit(arg[1]))
-      switch(*arg) {
-      case '-':
-	for(j=cur_line-1; j>=0; j--)
-	  if(line[j]->isLabel(arg)) {
-	    v = line[j]->Address();
-	    eval_lo = (byte)v;
-	    eval_addr = v >> RELOC_BIT;
-	    return v;
-	  }
-	break;
-
-      case '+':
-	for(j=cur_line+1; j<max_line; j++)
-	  if(line[j]->isLabel(arg)) {
-	    v = line[j]->Address();
-	    eval_lo = (byte)v;
-	    eval_addr = v >> RELOC_BIT;
-	    return v;
-	  }
-	break;
-
-      case '%':
-	if( (r = getenv(&arg[1])) )
-	  return atoi(r);
-	else
-	  return 0;
-	break;
-      }
-
-  smax = torpn(arg, stream);
-
-  ec = 0;
-  for(i=0; i<smax; i++)
-    if((stream[i] & OPER_FLAG) != OPER_FLAG)
-      ev[ec++] = stream[i];
-    else if(ec > 1) {
-      --ec;
-      switch(stream[i] & ~OPER_FLAG) {
-      case '+':
-	ev[ec-1] += ev[ec];
-	break;
-      case '-':
-	ev[ec-1] -= ev[ec];
-	break;
-      case '*':
-	ev[ec-1] *= ev[ec];
-	break;
-      case '/':
-	ev[ec-1] /= ev[ec];
-	break;
-      case '&':
-	ev[ec-1] &= ev[ec];
-	break;
-      case '|':
-	ev[ec-1] |= ev[ec];
-	break;
-      case '=':
-	ev[ec-1] = (ev[ec] == ev[ec-1]);
-	break;
-      }
-    }
-    else if(ec > 0) {
-      switch(stream[i] & ~OPER_FLAG) {
-      case '>':
-	eval_lo = (byte)ev[ec-1];
-	ev[ec-1] = (byte)(ev[ec-1] >> 8);
-	break;
-      case '<':
-	eval_addr = -eval_addr;
-	ev[ec-1] = (byte)ev[ec-1];
-	break;
-      case '^':
-	ev[ec-1] = (byte)(ev[ec-1] >> 16);
-	break;
-      case '!':
-	if((ev[ec-1] % 256) == 0)
-	  ev[ec-1] = (byte)(ev[ec-1] >> 8);
-	else
-	  ev[ec-1] = (byte)(ev[ec-1] >> 8) + 1;
-	break;
-      case '~':
-	ev[ec-1] = ~ev[ec-1];
-	break;
-      }
-    }
-
-  v = ev[ec-1];
-
-  if(eval_addr && eval_lo < 0)
-    eval_lo = (byte)v;
+  Expr e(arg);
 
-  return v;
+  return e.value();
 }
 
 int eval(char *arg)
@@ -1478,7 +1366,10 @@ int eval(char *arg)
   return 0;
 }
 
-int torpn(char *arg, int *stream)
+// Operands that depend on labels (or on anything but their own text)
+// are left to e to fill in when it is evaluated.
+
+int torpn(char *arg, int *stream, Expr *e)
 {
   register int i, k;
   int sp, st, nq;
@@ -1529,7 +1420,12 @@ int torpn(char *arg, int *stream)
     targ[k] = 0;
     --i;
 
-    stream[st++] = eval(targ);
+    if(*targ == '$' || *targ == '%' || isdigit(*targ))
+      stream[st++] = eval(targ);
+    else {
+      e->addSlot(st, targ);
+      stream[st++] = 0;
+    }
   }
 
   while(sp > 0)
@@ -1670,19 +1566,35 @@ char** splitstring(char *str, char* delim, int& max)
   return ar;
 }
 
+// Every mnemonic is three lowercase letters, so they index a table
+// directly. Entries are sym[] index+1, 0 for none.
+static short optable[26*26*26];
+
+#define OPINDEX(s) (((s)[0]-'a') * 676 + ((s)[1]-'a') * 26 + ((s)[2]-'a'))
+
 int whichOpcode(char *opcode)
 {
   register int i;
+  static int built = 0;
 
   if(opcode == NULL)
     return -1;
 
-  for(i=0; strcmp(sym[i].op, END) && strcmp(sym[i].op, opcode); i++);
+  if(! built) {
+    for(i=0; strcmp(sym[i].op, END); i++)
+      if(! optable[OPINDEX(sym[i].op)])
+        optable[OPINDEX(sym[i].op)] = i+1;
+    built = 1;
+  }
+
+  for(i=0; i<3; i++)
+    if(opcode[i] < 'a' || opcode[i] > 'z')
+      return -1;
 
-  if(strcmp(sym[i].op, END))
-    return i;
+  if(opcode[3])
+    return -1;
 
-  return -1;
+  return optable[OPINDEX(opcode)] - 1;
 }
 
 char* getstr(char *str, int max, FILE* fi)
@@ -1717,7 +1629,7 @@ void readMacro(char *fname)
   if( (fi = fopen(fname, "r")) ) {
     while(! feof(fi)) {
       for(i=0; macro[i]; i++);
-      macro = (Macro**)realloc(macro, sizeof(Macro*) * (i+2));
+      macro = (Macro**)growArray(macro, sizeof(Macro*), i+2, macro_alloc);
       macro[i+1] = NULL;
       macro[i] = new Macro(fi);
       if(! macro[i]->isValidMacro()) {
@@ -97,7 +97,7 @@ void fnsplit(char* fname, char* name, char* ext);
 void fnmerge(char* fname, char* name, char* ext);
 int evaluate(char* arg);
 int eval(char* arg);
-int torpn(char* arg, int *stream);
+int torpn(char* arg, int *stream, class Expr* e);
 int inparens(char* arg);
 char ASCtoPET(char c);
 int PETSCII(char* arg, int& used);
@@ -108,9 +108,44 @@ char* getstr(char* str, int max, FILE* fi);
 void putWord(int val, FILE* fo);
 void readMacro(char* fname);
 void add_addrmap(int hi, char* name);
+void* growArray(void* p, int size, int n, int& alloc);
 
 #define ____       -1
 
+#define OPER_FLAG  0x10000000
+#define OPER(a)    (a | OPER_FLAG)
+
+// Bump allocator for everything that lives as long as the assembly:
+// lines, labels and their strings. Nothing is freed on its own.
+
+class Arena
+{
+  char* chunk;         // newest chunk
+  int used;
+  int size;
+
+  char** itab;         // interned strings, open addressed
+  int isize;
+  int nintern;
+
+  int nchunks;
+  int nallocs;
+  long nbytes;
+  int nshared;
+
+  int slot(const char* str);
+
+public:
+  Arena(void);
+  ~Arena();
+
+  void* alloc(int n);
+  char* intern(const char* str);
+  void report(FILE* fo);
+};
+
+extern Arena arena;
+
 struct _code
 {
   short mode;
@@ -205,6 +240,8 @@ class File
 {
   char name[256];
   Block **b;
+  int nblocks;
+  int balloc;
 
 public:
   File(char* ifname);
@@ -223,21 +260,65 @@ class Label
 
 public:
   Label(char* iname, int iaddr);
-  ~Label();
+
+  void* operator new(size_t n) { return arena.alloc(n); }
+  void operator delete(void*) { }
 
   char* Name(void) { return name; }
   int Address(void) { return addr; }
   void setAddress(int iaddr) { addr = iaddr; }
 };
 
+// An expression parsed once by torpn(). Operands that depend on labels
+// are slots, looked up (and patched into the stream) each time value()
+// is called, so a pass only redoes the arithmetic.
+
+struct exprslot
+{
+  int pos;             // index into the stream
+  int type;
+  char* name;
+  char* member;        // label part of "lib.label"
+  Label* label;        // once found
+  int lib;             // lib[] index, once found
+};
+
+class Expr
+{
+  int kind;
+  char* text;          // anonymous label
+  int env;             // value of "%name"
+  int nstream;
+  int* stream;
+  int nslot;
+  exprslot* slot;
+  char* names;
+  char* block;         // stream, slots and names
+
+  int symbol(exprslot* s);
+
+public:
+  Expr(char* arg);
+  ~Expr();
+
+  void addSlot(int pos, char* name);
+  int value(void);
+};
+
 class LabelList
 {
   char title[65];
   int nlabels;
+  int lalloc;
   Label** label;
+  int* hash;           // open addressed, index+1 into label[] or 0
+  int hsize;           // power of 2, kept at least twice nlabels
   int used;
   int delib;
 
+  int hashSlot(char* name);
+  void rehash(int size);
+
 public:
   LabelList(char* iname=NULL);
   ~LabelList();
@@ -269,10 +350,25 @@ class Line
   char* file;
   int fline;
 
+  // Worked out by the first Process() and kept for the next run
+  int dir;             // directive[] index, -1 if none, -2 until compiled
+  int op;              // whichOpcode(cmd)
+  int amode;           // mode bits the argument's syntax gives
+  int nexpr;
+  Expr** expr;         // the argument, or each item of a data directive
+
+  void compile(void);
+  void operandMode(void);
+  void addExpr(char* arg);
+  void clearCompiled(void);
+
 public:
   Line(void);
   ~Line();
 
+  void* operator new(size_t n) { return arena.alloc(n); }
+  void operator delete(void*) { }
+
   int Parse(int ifline, char* ifile, char* line);
   int nextWord(char word[WORDLEN+1], char* line, int& ptr);
   void output(FILE* = stderr);
@@ -302,6 +398,8 @@ class Macro
 {
   char* name;
   Line **lines;
+  int nlines;
+  int lalloc;
 
 public:
   Macro(FILE* fi);
@@ -329,6 +427,7 @@ extern addrmap* map;
 extern int nmap;
 extern int address;
 extern int cur_line;
+extern int max_line;
 extern int enum_val;
 extern symtable sym[];
 extern int error_state;
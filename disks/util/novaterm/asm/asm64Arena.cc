@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "asm64.h"
+
+#define CHUNK     65536
+#define ALIGN     8
+#define INTERNINIT 1024
+
+Arena arena;
+
+static int ngrows = 0;
+
+
+Arena::Arena(void)
+{
+  chunk = NULL;
+  used = 0;
+  size = 0;
+
+  itab = NULL;
+  isize = 0;
+  nintern = 0;
+
+  nchunks = 0;
+  nallocs = 0;
+  nbytes = 0;
+  nshared = 0;
+}
+
+Arena::~Arena()
+{
+  char *next;
+
+  while(chunk) {
+    next = *(char**)chunk;
+    free(chunk);
+    chunk = next;
+  }
+
+  free(itab);
+}
+
+void* Arena::alloc(int n)
+{
+  char *c;
+  int csize;
+
+  n = (n + ALIGN-1) & ~(ALIGN-1);
+
+  if(used + n > size) {
+    // Each chunk starts with a pointer to the one before it
+    csize = (n + ALIGN > CHUNK) ? n + ALIGN : CHUNK;
+    c = (char*)malloc(csize);
+    *(char**)c = chunk;
+    chunk = c;
+    used = ALIGN;
+    size = csize;
+    ++nchunks;
+  }
+
+  c = &chunk[used];
+  used += n;
+
+  ++nallocs;
+  nbytes += n;
+
+  return c;
+}
+
+// The arena's copy of str, the same one for every caller. Like strcreate(),
+// NULL gives "". The strings must not be changed.
+
+char* Arena::intern(const char *str)
+{
+  register unsigned int h;
+  register char *p;
+  char **old;
+  int i, osize;
+
+  if(str == NULL)
+    str = "";
+
+  if(nintern * 2 >= isize) {
+    old = itab;
+    osize = isize;
+    isize = isize ? isize * 2 : INTERNINIT;
+    itab = (char**)calloc(isize, sizeof(char*));
+    nintern = 0;
+
+    for(i=0; i<osize; i++)
+      if(old[i]) {
+	itab[slot(old[i])] = old[i];
+	++nintern;
+      }
+    free(old);
+  }
+
+  h = slot(str);
+  if(itab[h]) {
+    ++nshared;
+    return itab[h];
+  }
+
+  p = (char*)alloc(strlen(str)+1);
+  strcpy(p, str);
+  itab[h] = p;
+  ++nintern;
+
+  return p;
+}
+
+// Slot holding str in itab, or the empty slot it would go in
+int Arena::slot(const char *str)
+{
+  register unsigned int h = 2166136261u;
+  register const char *p;
+
+  for(p=str; *p; p++)
+    h = (h ^ (unsigned char)*p) * 16777619u;
+
+  for(h &= isize-1; itab[h]; h = (h+1) & (isize-1))
+    if(! strcmp(str, itab[h]))
+      break;
+
+  return h;
+}
+
+void Arena::report(FILE* fo)
+{
+  struct rusage ru;
+
+  fprintf(fo, "asm64: Arena: %d allocations, %ld bytes in %d chunks\n",
+	  nallocs, nbytes, nchunks);
+  fprintf(fo, "asm64: Strings: %d interned, %d reused\n", nintern, nshared);
+  fprintf(fo, "asm64: Arrays grown: %d times\n", ngrows);
+
+  if(getrusage(RUSAGE_SELF, &ru) == 0)
+    fprintf(fo, "asm64: Peak RSS: %ld KB\n", ru.ru_maxrss);
+}
+
+
+// p with room for n elements of size bytes, doubling alloc as needed
+
+void* growArray(void *p, int size, int n, int& alloc)
+{
+  if(n <= alloc)
+    return p;
+
+  if(alloc < 16)
+    alloc = 16;
+  while(alloc < n)
+    alloc *= 2;
+
+  ++ngrows;
+
+  return realloc(p, size * alloc);
+}
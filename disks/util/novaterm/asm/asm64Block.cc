@@ -70,10 +70,8 @@ void Block::addBytes(byte *b, int num)
 {
   register int i;
 
-  while(size + num > alloc) {
-    alloc += 1024;
-    bytes = (byte*)realloc(bytes, alloc);
-  }
+  if(size + num > alloc)
+    bytes = (byte*)growArray(bytes, 1, size + num, alloc);
 
   for(i=0; i<num; i++)
     bytes[size++] = b[i];
@@ -268,7 +266,9 @@ File::File(char *ifname)
 {
   strcpy(name, ifname);
 
-  b = (Block**)malloc(sizeof(Block*));
+  nblocks = 0;
+  balloc = 0;
+  b = (Block**)growArray(NULL, sizeof(Block*), 1, balloc);
   b[0] = NULL;
 }
 
@@ -283,15 +283,11 @@ File::~File()
 
 Block* File::addBlock(int addr)
 {
-  register int i;
-
-  for(i=0; b[i]; i++);
+  b = (Block**)growArray(b, sizeof(Block*), nblocks+2, balloc);
+  b[nblocks] = new Block(addr);
+  b[nblocks+1] = NULL;
 
-  b = (Block**)realloc(b, sizeof(Block*)*(i+2));
-  b[i] = new Block(addr);
-  b[i+1] = NULL;
-
-  return b[i];
+  return b[nblocks++];
 }
 
 int File::output(void)
@@ -349,13 +345,13 @@ Reloc::~Reloc()
 
 void Reloc::addReloc(int off_addr, int iraddr, int lo_part)
 {
-  register int i;
+  int i;
 
   if(rsize+1 > ralloc) {
-    ralloc += 128;
-    raddr = (int*)realloc(raddr, sizeof(int) * ralloc);
+    i = ralloc;
+    raddr = (int*)growArray(raddr, sizeof(int), rsize+1, ralloc);
     if(rlopart)
-      rlopart = (int*)realloc(rlopart, sizeof(int) * ralloc);
+      rlopart = (int*)growArray(rlopart, sizeof(int), rsize+1, i);
   }
 
   raddr[rsize] = (off_addr + iraddr) & 0xffff;
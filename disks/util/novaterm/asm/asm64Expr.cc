@@ -0,0 +1,270 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "asm64.h"
+
+#define EXPR_RPN   0
+#define EXPR_ADDR  1         // "*"
+#define EXPR_ENV   2         // "%name", fixed once the options are read
+#define EXPR_ANON  3         // "-" or "+" label, then as EXPR_RPN
+
+#define SLOT_LABEL 0
+#define SLOT_LIB   1
+#define SLOT_EVAL  2         // anything else eval() knows about
+
+
+// The stream, the slots and their names share one allocation
+
+Expr::Expr(char *arg)
+{
+  register int i;
+  int tstream[512];
+  exprslot tslot[512];
+  char tname[WORDLEN+1];
+  char *r, *n;
+  int len;
+
+  text = NULL;
+  nstream = 0;
+  stream = NULL;
+  nslot = 0;
+  slot = NULL;
+  block = NULL;
+
+  while((*arg == ' ' || *arg == TAB) && *arg != 0)
+    ++arg;
+
+  if(! strcmp(arg, "*")) {
+    kind = EXPR_ADDR;
+    return;
+  }
+
+  kind = EXPR_RPN;
+
+  if(*arg == '-' || *arg == '+' || *arg == '%')
+    if(! isdigit(arg[1])) {
+      if(*arg == '%') {
+	kind = EXPR_ENV;
+	if( (r = getenv(&arg[1])) )
+	  env = atoi(r);
+	else
+	  env = 0;
+	return;
+      }
+
+      kind = EXPR_ANON;
+      text = strcreate(arg);
+    }
+
+  // addSlot() collects into tslot and tname while torpn() runs
+  slot = tslot;
+  names = tname;
+  nstream = torpn(arg, tstream, this);
+  len = names - tname;
+
+  block = (char*)malloc(sizeof(exprslot) * nslot + sizeof(int) * nstream + len);
+  slot = (exprslot*)block;
+  stream = (int*)&slot[nslot];
+  n = (char*)&stream[nstream];
+
+  memcpy(slot, tslot, sizeof(exprslot) * nslot);
+  memcpy(stream, tstream, sizeof(int) * nstream);
+  memcpy(n, tname, len);
+  for(i=0; i<nslot; i++) {
+    slot[i].name = n + (tslot[i].name - tname);
+    if(slot[i].member)
+      slot[i].member = n + (tslot[i].member - tname);
+  }
+  names = NULL;
+}
+
+Expr::~Expr()
+{
+  if(text)
+    delete[] text;
+  free(block);
+}
+
+void Expr::addSlot(int pos, char *name)
+{
+  exprslot *s;
+
+  s = &slot[nslot++];
+
+  // names is the constructor's buffer until the expression is parsed
+  s->pos = pos;
+  s->name = strcpy(names, name);
+  names += strlen(name) + 1;
+  s->member = NULL;
+  s->label = NULL;
+  s->lib = -1;
+
+  if(*name == '\"')
+    s->type = SLOT_EVAL;
+  else if( (s->member = strchr(s->name, '.')) ) {
+    *s->member++ = 0;
+    s->type = SLOT_LIB;
+  }
+  else
+    s->type = SLOT_LABEL;
+}
+
+// Same as eval() on the operand, remembering what it found
+
+int Expr::symbol(exprslot *s)
+{
+  register int i;
+  int v;
+
+  switch(s->type) {
+  case SLOT_LABEL:
+    if(! s->label)
+      s->label = lblist.findLabel(s->name);
+
+    if(s->label)
+      v = s->label->Address();
+    else {
+      error_state = ASM_NOLABEL;
+      v = 0x8000;
+    }
+
+    eval_addr = v >> RELOC_BIT;
+    return v;
+
+  case SLOT_LIB:
+    if(s->lib < 0) {
+      for(i=0; lib[i]; i++)
+	if(lib[i]->isLabelType(s->name))
+	  break;
+      if(! lib[i]) {
+	error_state = ASM_NOLABEL;
+	return 0;
+      }
+      s->lib = i;
+    }
+
+    if(! s->label)
+      s->label = lib[s->lib]->findLabel(s->member);
+
+    if(s->label)
+      v = s->label->Address();
+    else {
+      error_state = ASM_NOLABEL;
+      v = 0x8000;
+    }
+
+    v = (v & (RELOC_ADDR-1)) | ((s->lib+LIB_HI) << RELOC_BIT);
+    eval_addr = v >> RELOC_BIT;
+    return v;
+  }
+
+  return eval(s->name);
+}
+
+int Expr::value(void)
+{
+  register int i, j;
+  int v;
+  int ec, ev[512];
+
+  eval_addr = 0;
+  eval_lo = -1;
+
+  switch(kind) {
+  case EXPR_ADDR:
+    v = address;
+    eval_addr = v >> RELOC_BIT;    // =False if <$1000000, otherwise table number
+    return v;
+
+  case EXPR_ENV:
+    return env;
+
+  case EXPR_ANON:
+    if(*text == '-') {
+      for(j=cur_line-1; j>=0; j--)
+	if(line[j]->isLabel(text)) {
+	  v = line[j]->Address();
+	  eval_lo = (byte)v;
+	  eval_addr = v >> RELOC_BIT;
+	  return v;
+	}
+    }
+    else {
+      for(j=cur_line+1; j<max_line; j++)
+	if(line[j]->isLabel(text)) {
+	  v = line[j]->Address();
+	  eval_lo = (byte)v;
+	  eval_addr = v >> RELOC_BIT;
+	  return v;
+	}
+    }
+    break;
+  }
+
+  for(i=0; i<nslot; i++)
+    stream[slot[i].pos] = symbol(&slot[i]);
+
+  ec = 0;
+  for(i=0; i<nstream; i++)
+    if((stream[i] & OPER_FLAG) != OPER_FLAG)
+      ev[ec++] = stream[i];
+    else if(ec > 1) {
+      --ec;
+      switch(stream[i] & ~OPER_FLAG) {
+      case '+':
+	ev[ec-1] += ev[ec];
+	break;
+      case '-':
+	ev[ec-1] -= ev[ec];
+	break;
+      case '*':
+	ev[ec-1] *= ev[ec];
+	break;
+      case '/':
+	ev[ec-1] /= ev[ec];
+	break;
+      case '&':
+	ev[ec-1] &= ev[ec];
+	break;
+      case '|':
+	ev[ec-1] |= ev[ec];
+	break;
+      case '=':
+	ev[ec-1] = (ev[ec] == ev[ec-1]);
+	break;
+      }
+    }
+    else if(ec > 0) {
+      switch(stream[i] & ~OPER_FLAG) {
+      case '>':
+	eval_lo = (byte)ev[ec-1];
+	ev[ec-1] = (byte)(ev[ec-1] >> 8);
+	break;
+      case '<':
+	eval_addr = -eval_addr;
+	ev[ec-1] = (byte)ev[ec-1];
+	break;
+      case '^':
+	ev[ec-1] = (byte)(ev[ec-1] >> 16);
+	break;
+      case '!':
+	if((ev[ec-1] % 256) == 0)
+	  ev[ec-1] = (byte)(ev[ec-1] >> 8);
+	else
+	  ev[ec-1] = (byte)(ev[ec-1] >> 8) + 1;
+	break;
+      case '~':
+	ev[ec-1] = ~ev[ec-1];
+	break;
+      }
+    }
+
+  v = ev[ec-1];
+
+  if(eval_addr && eval_lo < 0)
+    eval_lo = (byte)v;
+
+  return v;
+}
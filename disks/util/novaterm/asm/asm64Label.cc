@@ -8,24 +8,24 @@
 #include "asm64.h"
 
 #define EMPTY  "---"
+#define HASHINIT  64
 
 Label::Label(char *iname, int iaddr)
 {
-  name = strcreate(iname);
+  name = arena.intern(iname);
   addr = iaddr;
 }
 
-Label::~Label()
-{
-  delete[] name;
-}
-
 
 LabelList::LabelList(char *iname)
 {
-  label = (Label**)malloc(sizeof(Label*));
+  lalloc = 0;
+  label = (Label**)growArray(NULL, sizeof(Label*), 1, lalloc);
   label[0] = NULL;
 
+  hash = (int*)calloc(HASHINIT, sizeof(int));
+  hsize = HASHINIT;
+
   nlabels = 0;
   if(iname) {
     strncpy(title, iname, 64);
@@ -38,14 +38,12 @@ LabelList::LabelList(char *iname)
   delib = 0;
 }
 
+// The labels themselves belong to the arena
+
 LabelList::~LabelList()
 {
-  register int i;
-
-  for(i=0; label[i]; i++)
-    delete label[i];
-
   free(label);
+  free(hash);
 }
 
 void LabelList::setLabelType(char *iname)
@@ -68,10 +66,15 @@ void LabelList::addLabel(char *name, int addr, int run)
   Label* l;
 
   if( (l = findLabel(name)) == NULL) {
-    label = (Label**)realloc(label, sizeof(Label*) * (nlabels+2));
+    label = (Label**)growArray(label, sizeof(Label*), nlabels+2, lalloc);
     label[nlabels] = new Label(name, addr);
     label[nlabels+1] = NULL;
     ++nlabels;
+
+    if(nlabels * 2 > hsize)
+      rehash(hsize * 2);
+    else
+      hash[hashSlot(name)] = nlabels;
   }
   else {
     l->setAddress(addr);
@@ -80,15 +83,42 @@ void LabelList::addLabel(char *name, int addr, int run)
   }
 }
 
-Label* LabelList::findLabel(char *name)
+// Slot holding name, or the empty slot it would go in
+int LabelList::hashSlot(char *name)
+{
+  register unsigned int h = 2166136261u;
+  register char *p;
+
+  for(p=name; *p; p++)
+    h = (h ^ (unsigned char)*p) * 16777619u;
+
+  for(h &= hsize-1; hash[h]; h = (h+1) & (hsize-1))
+    if(! strcmp(name, label[hash[h]-1]->Name()))
+      break;
+
+  return h;
+}
+
+void LabelList::rehash(int size)
 {
   register int i;
 
+  free(hash);
+  hash = (int*)calloc(size, sizeof(int));
+  hsize = size;
+
   for(i=0; label[i]; i++)
-    if(! strcmp(name, label[i]->Name()))
-      return label[i];
+    hash[hashSlot(label[i]->Name())] = i+1;
+}
+
+Label* LabelList::findLabel(char *name)
+{
+  register int i;
+
+  if( (i = hash[hashSlot(name)]) == 0)
+    return NULL;
 
-  return NULL;
+  return label[i-1];
 }
 
 int LabelList::findLabelValue(char *name)
@@ -10,6 +10,8 @@
 
 #define strendcmp(a, b)  (strlen(a) >= strlen(b) ? strcmp(&a[strlen(a)-strlen(b)], b) : 1 )
 
+static int lib_alloc = 0;
+
 static char space[] = { ' ', TAB, CR, LF, '=', 0 };
 
 static char *directive[]=
@@ -38,6 +40,10 @@ Line::Line(void)
   cmd = NULL;
   arg = NULL;
   file = NULL;
+
+  dir = -2;
+  nexpr = 0;
+  expr = NULL;
 }
 
 Line::~Line()
@@ -45,19 +51,29 @@ Line::~Line()
   Clear();
 }
 
+// The strings are interned in the arena, so they are just dropped
+
 void Line::Clear(void)
 {
-  if(label)
-    delete[] label;
-  if(cmd)
-    delete[] cmd;
-  if(arg)
-    delete[] arg;
-
   label = NULL;
   cmd = NULL;
   arg = NULL;
   file = NULL;
+
+  clearCompiled();
+}
+
+void Line::clearCompiled(void)
+{
+  register int i;
+
+  for(i=0; i<nexpr; i++)
+    delete expr[i];
+  free(expr);
+
+  dir = -2;
+  nexpr = 0;
+  expr = NULL;
 }
 
 int Line::Parse(int ifline, char* ifile, char* line)
@@ -106,31 +122,31 @@ int Line::Parse(int ifline, char* ifile, char* line)
       switch(k) {
       case WORD_NORMAL:
 	if(o < 0)
-	  label = strcreate(word);
+	  label = arena.intern(word);
 	else
-	  cmd = strcreate(word);
+	  cmd = arena.intern(word);
 	break;
 
       case WORD_ASSIGN:
 	if(o >= 0)
 	  err = ASM_ISOP;
 	else
-	  label = strcreate(word);
+	  label = arena.intern(word);
 	break;
       }
 
     else if(cmd == NULL && arg == NULL) {
       if(o < 0) {
 	if(ok == WORD_ASSIGN)
-	  cmd = strcreate("=");
-	arg = strcreate(word);
+	  cmd = arena.intern("=");
+	arg = arena.intern(word);
       }
       else
-	cmd = strcreate(word);
+	cmd = arena.intern(word);
     }
 
     else if(arg == NULL)
-      arg = strcreate(word);
+      arg = arena.intern(word);
 
     else
       err = ASM_EXTRA;
@@ -204,20 +220,18 @@ int Line::nextWord(char word[WORDLEN+1], char *line, int& ptr)
   return WORD_NORMAL;
 }
 
+// Shares line's strings, which are never changed in place
+
 void Line::copy(int ifline, Line* line)
 {
   Clear();
 
   fline = ifline;
 
-  if(line->label)
-    label = strcreate(line->label);
-  if(line->cmd)
-    cmd = strcreate(line->cmd);
-  if(line->arg)
-    arg = strcreate(line->arg);
-  if(line->file)
-    file = strcreate(line->file);
+  label = line->label;
+  cmd = line->cmd;
+  arg = line->arg;
+  file = line->file;
 }
 
 void Line::output(FILE* fo)
@@ -228,27 +242,94 @@ void Line::output(FILE* fo)
 	 (arg == NULL) ? "" : arg);
 }
 
+// What Process() needs of the line that doesn't change between runs:
+// which directive or opcode it is and its argument(s) as expressions.
+
+void Line::compile(void)
+{
+  register int i;
+  char **args;
+  int max;
+
+  dir = -1;
+  op = -1;
+
+  if(isCommand("=")) {
+    if(arg)
+      addExpr(arg);
+    return;
+  }
+
+  if(! cmd)
+    return;
+
+  for(i=0; directive[i]; i++)
+    if(isCommand(directive[i]))
+      break;
+
+  if(directive[i]) {
+    if(i == DIR_BYT)
+      i = DIR_BYTE;
+    if(i == DIR_ASC)
+      i = DIR_TEXT;
+    if(i == DIR_Z)
+      i = DIR_ZERO;
+
+    dir = i;
+
+    switch(i) {
+    case DIR_BYTE:  case DIR_WORD:  case DIR_NWORD:
+    case DIR_LONG:  case DIR_DWORD: case DIR_NDWORD:
+      if(! arg)
+	break;
+
+      args = splitstring(arg, ",", max);
+      delete[] args[0];
+      for(i=1; args[i]; i++) {
+	addExpr(args[i]);
+	delete[] args[i];
+      }
+      delete[] args;
+      break;
+    }
+
+    return;
+  }
+
+  if( (op = whichOpcode(cmd)) >= 0)
+    operandMode();
+}
+
+void Line::addExpr(char *arg)
+{
+  expr = (Expr**)realloc(expr, sizeof(Expr*) * (nexpr+1));
+  expr[nexpr++] = new Expr(arg);
+}
+
 int Line::Process(int run, byte *bytes, reloc *raddr, int& rsize)
 {
   register int i, j, b=0;
-  int op, ophex, val, amode, naddr;
+  int ophex, val, mode, naddr;
   BOOL is_addr;
 
   addr = address;
   rsize = 0;
 
+  if(dir == -2)
+    compile();
+
   // Check for label assignment
 
   if(isCommand("=")) {
     if(enum_val >= 0) {
-      val = evaluate(arg);
+      val = nexpr ? expr[0]->value() : 0;
       lblist.addLabel(label, enum_val, run);
       enum_val += val;
       return 0;
     }
     else if(isLabel("*")) {
       if(arg) {
-	address = evaluate(arg);
+	address = expr[0]->value();
 	if(verbose)
 	  fprintf(stderr, "new address: %4x\n", address);
 	return 0;
@@ -256,7 +337,7 @@ int Line::Process(int run, byte *bytes, reloc *raddr, int& rsize)
     }
     else {
       if(arg)
-	val = evaluate(arg);
+	val = expr[0]->value();
       else
 	val = 0;
 
@@ -277,19 +358,8 @@ int Line::Process(int run, byte *bytes, reloc *raddr, int& rsize)
 
   // Check for directive
 
-  for(i=0; directive[i]; i++)
-    if(isCommand(directive[i]))
-      break;
-
-  if(directive[i]) {
-    if(i == DIR_BYT)
-      i = DIR_BYTE;
-    if(i == DIR_ASC)
-      i = DIR_TEXT;
-    if(i == DIR_Z)
-      i = DIR_ZERO;
-
-    switch(i) {
+  if(dir >= 0) {
+    switch(i = dir) {
     case DIR_END:
       return 0;
 
@@ -403,37 +473,25 @@ int Line::Process(int run, byte *bytes, reloc *raddr, int& rsize)
 
     case DIR_BYTE:
       {
-	char **args;
-	int max;
-
-	args = splitstring(arg, ",", max);
-	delete[] args[0];
-	for(i=1; args[i]; i++) {
-	  bytes[b++] = (byte)evaluate(args[i]);
+	for(i=0; i<nexpr; i++) {
+	  bytes[b++] = (byte)expr[i]->value();
 	  if(eval_addr) {
 	    raddr[rsize].hi_byte = (eval_addr > 0) ? True : False;
 	    raddr[rsize].off = b-1;
 	    raddr[rsize].hi = abs(eval_addr);
 	    raddr[rsize++].lo = eval_lo;
 	  }
-
-	  delete[] args[i];
 	}
-	delete[] args;
 
 	return b;
       }
 
     case DIR_WORD:
       {
-	char **args;
-	int max;
 	int val;
 
-	args = splitstring(arg, ",", max);
-	delete[] args[0];
-	for(i=1; args[i]; i++) {
-	  val = evaluate(args[i]);
+	for(i=0; i<nexpr; i++) {
+	  val = expr[i]->value();
 	  bytes[b++] = (byte)val;
 	  bytes[b++] = (byte)(val >> 8);
 	  if(eval_addr) {
@@ -446,24 +504,17 @@ int Line::Process(int run, byte *bytes, reloc *raddr, int& rsize)
 	    raddr[rsize].hi = eval_addr;
 	    raddr[rsize++].lo = eval_lo;
 	  }
-
-	  delete[] args[i];
 	}
-	delete[] args;
 
 	return b;
       }
 
     case DIR_NWORD:
       {
-	char **args;
-	int max;
 	int val;
 
-	args = splitstring(arg, ",", max);
-	delete[] args[0];
-	for(i=1; args[i]; i++) {
-	  val = evaluate(args[i]);
+	for(i=0; i<nexpr; i++) {
+	  val = expr[i]->value();
 	  bytes[b++] = (byte)(val >> 8);
 	  bytes[b++] = (byte)val;
 	  if(eval_addr) {
@@ -476,72 +527,51 @@ int Line::Process(int run, byte *bytes, reloc *raddr, int& rsize)
 	    raddr[rsize].hi = eval_addr;
 	    raddr[rsize++].lo = eval_lo;
 	  }
-
-	  delete[] args[i];
 	}
-	delete[] args;
 
 	return b;
       }
 
     case DIR_LONG:
       {
-	char **args;
-	int max;
 	int val;
 
-	args = splitstring(arg, ",", max);
-	delete[] args[0];
-	for(i=1; args[i]; i++) {
-	  val = evaluate(args[i]);
+	for(i=0; i<nexpr; i++) {
+	  val = expr[i]->value();
 	  bytes[b++] = (byte)val;
 	  bytes[b++] = (byte)(val >> 8);
 	  bytes[b++] = (byte)(val >> 16);
-	  delete[] args[i];
 	}
-	delete[] args;
 
 	return b;
       }
 
     case DIR_DWORD:
       {
-	char **args;
-	int max;
 	int val;
 
-	args = splitstring(arg, ",", max);
-	delete[] args[0];
-	for(i=1; args[i]; i++) {
-	  val = evaluate(args[i]);
+	for(i=0; i<nexpr; i++) {
+	  val = expr[i]->value();
 	  bytes[b++] = (byte)val;
 	  bytes[b++] = (byte)(val >> 8);
 	  bytes[b++] = (byte)(val >> 16);
 	  bytes[b++] = (byte)(val >> 24);
-	  delete[] args[i];
 	}
-	delete[] args;
 
 	return b;
       }
 
     case DIR_NDWORD:
       {
-	char **args;
-	int max;
 	int val;
 
-	args = splitstring(arg, ",", max);
-	delete[] args[0];
-	for(i=1; args[i]; i++) {
-	  val = evaluate(args[i]);
+	for(i=0; i<nexpr; i++) {
+	  val = expr[i]->value();
 	  bytes[b++] = (byte)(val >> 24);
 	  bytes[b++] = (byte)(val >> 16);
 	  bytes[b++] = (byte)(val >> 8);
 	  bytes[b++] = (byte)val;
-	  delete[] args[i];
 	}
-	delete[] args;
 
 	return b;
       }
@@ -660,7 +690,7 @@ int Line::Process(int run, byte *bytes, reloc *raddr, int& rsize)
 	}
 
 	for(i=0; lib[i]; i++);
-	lib = (LabelList**)realloc(lib, sizeof(LabelList*) * (i+2));
+	lib = (LabelList**)growArray(lib, sizeof(LabelList*), i+2, lib_alloc);
 	lib[i+1] = NULL;
 	lib[i] = new LabelList();
 	lib[i]->loadTable(fname);
@@ -687,7 +717,7 @@ int Line::Process(int run, byte *bytes, reloc *raddr, int& rsize)
 	}
 
 	for(i=0; lib[i]; i++);
-	lib = (LabelList**)realloc(lib, sizeof(LabelList*) * (i+2));
+	lib = (LabelList**)growArray(lib, sizeof(LabelList*), i+2, lib_alloc);
 	lib[i+1] = NULL;
 	lib[i] = new LabelList();
 	lib[i]->loadTable(fname);
@@ -758,14 +788,12 @@ int Line::Process(int run, byte *bytes, reloc *raddr, int& rsize)
   if(! cmd)
     return 0;
 
-  op = whichOpcode(cmd);
-
   if(op >= 0) {
-    amode = getAddressMode(op, val, ophex);
+    mode = getAddressMode(op, val, ophex);
 
     bytes[b++] = ophex;
 
-    if(amode == M_RELL) {
+    if(mode == M_RELL) {
       eval_addr = False;
       val -= address+2;
       if(val < -32768 || val > 32767) {
@@ -776,7 +804,7 @@ int Line::Process(int run, byte *bytes, reloc *raddr, int& rsize)
       if(val < 0)
 	val += 65536;
     }
-    else if(amode == M_REL) {
+    else if(mode == M_REL) {
       eval_addr = False;
       val -= address+2;
       if(val < -128 || val > 127) {
@@ -788,7 +816,7 @@ int Line::Process(int run, byte *bytes, reloc *raddr, int& rsize)
 	val += 256;
     }
 
-    if((amode & B_ZP) || (amode & B_REL) || amode == M_IMM) {
+    if((mode & B_ZP) || (mode & B_REL) || mode == M_IMM) {
       bytes[b++] = (byte)val;
       if(eval_addr) {
 	raddr[rsize].hi_byte = (eval_addr < 0) ? False : True;
@@ -797,7 +825,7 @@ int Line::Process(int run, byte *bytes, reloc *raddr, int& rsize)
 	raddr[rsize++].lo = eval_lo;
       }
     }
-    else if((amode & B_ADDR16) || (amode & B_RELL) || amode == M_IMML) {
+    else if((mode & B_ADDR16) || (mode & B_RELL) || mode == M_IMML) {
       bytes[b++] = (byte)val;
       bytes[b++] = (byte)(val >> 8);
       if(eval_addr) {
@@ -811,7 +839,7 @@ int Line::Process(int run, byte *bytes, reloc *raddr, int& rsize)
 	raddr[rsize++].lo = eval_lo;
       }
     }
-    else if(amode & B_LONG) {
+    else if(mode & B_LONG) {
       bytes[b++] = (byte)val;
       bytes[b++] = (byte)(val >> 8);
       bytes[b++] = (byte)(val >> 16);
@@ -826,35 +854,61 @@ int Line::Process(int run, byte *bytes, reloc *raddr, int& rsize)
 
 int Line::getAddressMode(int opcode, int& val, int& ophex)
 {
-  register int a, i, n, x1, x2;
-  char *r, *tr;
-  char targ[256];
-  int mode=0;
+  int mode = amode;
 
   val = 0;
 
+  if(arg) {
+    val = expr[0]->value();
+
+    if(! (mode & B_IMMED)) {
+      if(val < (1 << 8))
+	mode |= B_ZP;
+      else if(val >= (1 << 16) && val < RELOC_ADDR)
+	mode |= B_LONG;
+      else
+	mode |= B_ADDR16;
+    }
+  }
+
+  if( (ophex = findAddressMode(opcode, mode)) < 0)
+    error_state = ASM_SYNTAX;
+
+  return mode;
+}
+
+// Mode bits from the argument's syntax. The operand's size is left to
+// getAddressMode(), since it depends on the value.
+
+void Line::operandMode(void)
+{
+  register int a, n, x1, x2;
+  char targ[256];
+
+  amode = 0;
+
   if(! arg)
-    mode = M_IMP;
+    amode = M_IMP;
   else if(*arg == '#') {
     a = 1;
     if(arg[a] == '#') {
       ++a;
-      mode |= B_LONG;
+      amode |= B_LONG;
     }
-    val = evaluate(&arg[a]);
-    mode |= B_IMMED;
+    addExpr(&arg[a]);
+    amode |= B_IMMED;
   }
   else {
     x1 = 0;
     x2 = 0;
 
     if(! strendcmp(arg, ",x")) {
-      mode |= B_IX;
+      amode |= B_IX;
       x2 = 2;
     }
 
     else if(*arg == '(' && ! strendcmp(arg, ",s),y")) {
-      mode |= B_IND | B_IS | B_IY;
+      amode |= B_IND | B_IS | B_IY;
       x1 = 1;
       x2 = 5;
     }
@@ -864,47 +918,47 @@ int Line::getAddressMode(int opcode, int& val, int& ophex)
       targ[strlen(arg)-2] = 0;
 
       if(inparens(targ)) {
-	mode |= B_IND | B_IY;
+	amode |= B_IND | B_IY;
 	x1 = 1;
 	x2 = 3;
       }
       else {
-	mode |= B_IY;
+	amode |= B_IY;
 	x2 = 2;
       }
     }
 
     else if(*arg == '[' && ! strendcmp(arg, "],y")) {
-      mode |= B_INDL | B_IY;
+      amode |= B_INDL | B_IY;
       x1 = 1;
       x2 = 3;
     }
 
     else if(! strendcmp(arg, ",y")) {
-      mode |= B_IY;
+      amode |= B_IY;
       x2 = 2;
     }
 
     else if(! strendcmp(arg, ",s")) {
-      mode |= B_IS;
+      amode |= B_IS;
       x2 = 2;
     }
 
     else if(! strendcmp(arg, ",x)")) {
-      mode |= B_IND | B_IX;
+      amode |= B_IND | B_IX;
       x1 = 1;
       x2 = 3;
     }
 
     else if(*arg == '[' && ! strendcmp(arg, "]")) {
-      mode |= B_INDL;
+      amode |= B_INDL;
       x1 = 1;
       x2 = 1;
     }
 
     else if(*arg == '(' && ! strendcmp(arg, ")")) {
       if(inparens(arg)) {
-	mode |= B_IND;
+	amode |= B_IND;
 	x1 = 1;
 	x2 = 1;
       }
@@ -914,20 +968,8 @@ int Line::getAddressMode(int opcode, int& val, int& ophex)
     strncpy(targ, &arg[x1], n);
     targ[n] = 0;
 
-    val = evaluate(targ);
-
-    if(val < (1 << 8))
-      mode |= B_ZP;
-    else if(val >= (1 << 16) && val < RELOC_ADDR)
-      mode |= B_LONG;
-    else
-      mode |= B_ADDR16;
+    addExpr(targ);
   }
-
-  if( (ophex = findAddressMode(opcode, mode)) < 0)
-    error_state = ASM_SYNTAX;
-
-  return mode;
 }
 
 int Line::findAddressMode(int op, int& mode)
@@ -1005,6 +1047,9 @@ BOOL Line::replaceArgument(int anum, char *aname)
   sprintf(astr, "@%d", anum);
   strcpy(work, arg);
 
+  if(! strstr(work, astr))
+    return True;
+
   do {
     r = strstr(work, astr);
     if(! r)
@@ -1019,19 +1064,18 @@ BOOL Line::replaceArgument(int anum, char *aname)
   }
   while(r != NULL);
 
-  delete[] arg;
-  arg = strcreate(work);
+  arg = arena.intern(work);
+  clearCompiled();
 
   return True;
 }
 
 void Line::replaceLabel(char *l)
 {
-  if(label)
-    delete[] label;
-
   if(l)
-    label = strcreate(l);
+    label = arena.intern(l);
   else
     label = NULL;
+
+  clearCompiled();
 }
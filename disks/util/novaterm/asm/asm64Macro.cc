@@ -8,10 +8,11 @@ Macro::Macro(FILE* fi)
 {
   Line li;
   char str[1024];
-  register int i;
 
   name = NULL;
-  lines = (Line**)malloc(sizeof(Line*));
+  nlines = 0;
+  lalloc = 0;
+  lines = (Line**)growArray(NULL, sizeof(Line*), 1, lalloc);
   lines[0] = NULL;
 
   do {
@@ -23,7 +24,7 @@ Macro::Macro(FILE* fi)
   if(feof(fi))
     return;
 
-  name = strcreate(li.Label());
+  name = arena.intern(li.Label());
 
   do
     getstr(str, 1024, fi);
@@ -38,25 +39,19 @@ Macro::Macro(FILE* fi)
       continue;
 
     if(li.Parse(0, NULL, str) >= 0) {
-      for(i=0; lines[i]; i++);
-      lines = (Line**)realloc(lines, sizeof(Line*) * (i+2));
-      lines[i] = new Line;
-      lines[i]->copy(0, &li);
-      lines[i+1] = NULL;
+      lines = (Line**)growArray(lines, sizeof(Line*), nlines+2, lalloc);
+      lines[nlines] = new Line;
+      lines[nlines]->copy(0, &li);
+      lines[++nlines] = NULL;
     }
   }
 }
 
+// The lines and name belong to the arena
+
 Macro::~Macro()
 {
-  register int i;
-
-  if(name)
-    delete[] name;
-
-  for(i=0; lines[i]; i++)
-    delete lines[i];
-  delete[] lines;
+  free(lines);
 }
 
 BOOL Macro::isValidMacro(void)
@@ -78,10 +73,7 @@ void Macro::output(void)
 
 int Macro::lineCount(void)
 {
-  register int i;
-
-  for(i=0; lines[i]; i++);
-  return i;
+  return nlines;
 }
 
 int Macro::putLines(int ifline, Line** ls, char *arg, char *label)
@@ -91,6 +83,7 @@ int Macro::putLines(int ifline, Line** ls, char *arg, char *label)
 
   alist = parseArgument(arg);
 
+  // The expansion shares the body's strings until an @n replaces one
   for(i=0; lines[i]; i++) {
     ls[i] = new Line;
     ls[i]->copy(ifline, lines[i]);
@@ -104,7 +97,7 @@ int Macro::putLines(int ifline, Line** ls, char *arg, char *label)
 
   for(i=0; alist[i]; i++)
     delete[] alist[i];
-  delete[] alist;
+  free(alist);
 
   return 0;
 }
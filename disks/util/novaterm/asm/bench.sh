@@ -0,0 +1,53 @@
+#!/bin/sh
+# Usage: ./bench.sh [lines] [asm64]
+#
+# Times asm64 on a synthetic source of about <lines> lines (default
+# 50000): a .lst label table, zero page equates, and code that refers
+# to labels before and after it, with tables and anonymous branches.
+# The sources are left in bench/ so runs can be compared.
+
+lines=${1:-50000}
+asm=${2:-./asm64}
+
+mkdir -p bench
+
+awk -v n=$lines '
+BEGIN {
+  srand(64)
+  nlab = 2000
+  print "ext" > "bench/bench.lab"
+  for (i = 0; i < nlab; i++)
+    printf "ext%d %x\n", i, 0xc000 + i * 3 >> "bench/bench.lab"
+
+  print ".lst \"bench/bench.lab\""
+  for (i = 0; i < 200; i++)
+    printf "zp%d = $%02x\n", i, i + 2
+  print ".tst \"bench/bench.labels\""
+
+  nsub = int((n - 203) / 11)
+  for (s = 0; s < nsub; s++) {
+    # Keep every chunk of code inside 64K
+    if (s % 2000 == 0)
+      print "*= $1000"
+    printf "sub%d\t\tlda zp%d\n", s, s % 200
+    printf "\t\tldx #<tab%d\n", s
+    printf "\t\tldy #>tab%d\n", s
+    printf "-\t\tsta ext%d,x\n", int(rand() * nlab)
+    printf "\t\tjsr sub%d\n", int(rand() * nsub)
+    printf "\t\tdex\n"
+    printf "\t\tbne -\n"
+    printf "\t\tbeq +\n"
+    printf "\t\tjmp sub%d\n", int(rand() * nsub)
+    printf "+\t\trts\n"
+    printf "tab%d\t\t.byt zp%d+1,<sub%d,>sub%d\n", s, s % 200, s, s
+  }
+}' > bench/bench.src
+
+echo "`wc -l < bench/bench.src` lines, `grep -c '^[a-z]' bench/bench.src` labels"
+
+start=`date +%s.%N`
+$asm bench/bench.src 2> bench/bench.err
+end=`date +%s.%N`
+
+secs=`awk -v a=$start -v b=$end 'BEGIN { printf "%.2f", b - a }'`
+echo "asm64: ${secs}s, `grep -c ERROR bench/bench.err` errors"
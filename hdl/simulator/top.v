@@ -36,6 +36,9 @@ module top(
            input standard_sw,   // video standard toggle switch
            output clk_phi,      // output phi clock for CPU
            output clk_dot4x,    // pixel clock
+`ifdef NATIVE_VIDEO
+           output [3:0] native_color, // pixel sequencer color (no video outputs)
+`endif
 `ifdef WITH_DVI
            input clk_dvi,       // pixel clock
 `endif
@@ -235,6 +238,22 @@ assign ado_sim = ado;
 assign dbo_sim = dbo;
 // End diff
 
+`ifdef NATIVE_VIDEO
+// Nothing downstream consumes pixel_color3 in this config, so pull it
+// out here for the simulator to render. Other configs render the RGB
+// output, which comes out of the line buffer in hires_vga_sync.v one
+// raster line late. Delay it by the same line here (one entry per
+// dot4x tick of the line) so both draw the same frame.
+reg [3:0] native_line[0:4095];
+wire [11:0] native_addr;
+assign native_addr = {vic_inst.raster_x,
+                      vic_inst.dot_rising[2] | vic_inst.dot_rising[3],
+                      vic_inst.dot_rising[1] | vic_inst.dot_rising[3]};
+always @(posedge clk_dot4x)
+    native_line[native_addr] <= vic_inst.pixel_color3;
+assign native_color = native_line[native_addr];
+`endif
+
 `ifdef WITH_DVI
 wire[31:0] red_scaled;
 wire[31:0] green_scaled;
@@ -0,0 +1,64 @@
+#!/bin/bash
+# Usage
+# ./build_matrix.sh [-j jobs] [-c configs] [-r clocks]
+#
+# Builds the simulator for every SIM_CONFIG and PAL/NTSC clock pair in
+# parallel, each in its own obj_dir_cfgN_palXX_ntscYY (make config_build).
+# Combinations whose inputs haven't changed since their last build are
+# reused as they are. Model compiles go through ccache when it is
+# installed, with one cache shared by all of them.
+#
+#   -j jobs     builds at once (default: cores / 4)
+#   -c configs  SIM_CONFIG values (default: "0 1 2 3 4 5 6 7 8 9 10 11")
+#   -r clocks   PAL_RES:NTSC_RES pairs (default: "29MHZ:26MHZ 32MHZ:32MHZ")
+#
+# Each build logs to matrix_logs/cfgN_palXX_ntscYY.log. The exit status
+# is non-zero if any of them failed.
+
+jobs=$(( (`nproc` + 3) / 4 ))
+configs="0 1 2 3 4 5 6 7 8 9 10 11"
+clocks="29MHZ:26MHZ 32MHZ:32MHZ"
+while getopts "j:c:r:" opt
+do
+   case $opt in
+      j) jobs=$OPTARG ;;
+      c) configs=$OPTARG ;;
+      r) clocks=$OPTARG ;;
+      *) exit 1 ;;
+   esac
+done
+
+cd `dirname $0`
+mkdir -p matrix_logs
+
+# Shared by every build, so made once up front
+make -s gen_config vicii_ipc.o || exit 1
+
+build_one() {
+   config=$1
+   pal=${2%:*}
+   ntsc=${2#*:}
+   name=cfg${config}_pal${pal}_ntsc${ntsc}
+   start=`date +%s`
+   if make config_build SIM_CONFIG=$config PAL_RES=$pal NTSC_RES=$ntsc \
+         > matrix_logs/$name.log 2>&1
+   then
+      status=ok
+   else
+      status=FAILED
+   fi
+   echo "$status $name ($((`date +%s` - start))s) `tail -1 matrix_logs/$name.log`"
+}
+export -f build_one
+
+for c in $configs
+do
+   for r in $clocks
+   do
+      echo "$c $r"
+   done
+done | xargs -P $jobs -L 1 bash -c 'build_one $0 $1' | tee matrix_logs/summary.txt
+
+failed=`grep -c "^FAILED " matrix_logs/summary.txt`
+echo "`wc -l < matrix_logs/summary.txt` builds, $failed failed"
+[ $failed -eq 0 ]
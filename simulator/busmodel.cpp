@@ -0,0 +1,97 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "busmodel.h"
+#include "log.h"
+
+struct busmodel* bus_create() {
+  struct busmodel* bus = new busmodel();
+  bus->ras = 1;
+  bus->cas = 1;
+  return bus;
+}
+
+void bus_destroy(struct busmodel* bus) {
+  delete bus;
+}
+
+// Read up to max bytes of filename into dst. Returns bytes read or -1.
+static long load_file(const char* filename, uint8_t* dst, long max) {
+  FILE* fp = fopen(filename, "rb");
+  if (fp == nullptr) {
+     LOG(LOG_ERROR, "can't open %s", filename);
+     return -1;
+  }
+  long n = fread(dst, 1, max, fp);
+  if (fgetc(fp) != EOF)
+     LOG(LOG_WARN, "%s is larger than %ld bytes, truncated", filename, max);
+  fclose(fp);
+  return n;
+}
+
+int bus_load_prg(struct busmodel* bus, const char* filename) {
+  uint8_t buf[2 + BUS_RAM_SIZE];
+  long n = load_file(filename, buf, sizeof(buf));
+  if (n < 2) {
+     if (n >= 0)
+        LOG(LOG_ERROR, "%s is not a PRG", filename);
+     return 1;
+  }
+  unsigned int addr = buf[0] | (buf[1] << 8);
+  n -= 2;
+  if (addr + n > BUS_RAM_SIZE) {
+     LOG(LOG_WARN, "%s runs past $ffff, truncated", filename);
+     n = BUS_RAM_SIZE - addr;
+  }
+  memcpy(bus->ram + addr, buf + 2, n);
+  LOG(LOG_INFO, "loaded %s at $%04x-$%04lx", filename, addr, addr + n - 1);
+  return 0;
+}
+
+int bus_load_bin(struct busmodel* bus, const char* filename,
+                 unsigned int addr) {
+  if (addr >= BUS_RAM_SIZE) {
+     LOG(LOG_ERROR, "bad load address $%x for %s", addr, filename);
+     return 1;
+  }
+  long n = load_file(filename, bus->ram + addr, BUS_RAM_SIZE - addr);
+  if (n < 0)
+     return 1;
+  LOG(LOG_INFO, "loaded %s at $%04x-$%04lx", filename, addr, addr + n - 1);
+  return 0;
+}
+
+int bus_load_color(struct busmodel* bus, const char* filename) {
+  return load_file(filename, bus->color, BUS_COLOR_SIZE) < 0;
+}
+
+int bus_load_charrom(struct busmodel* bus, const char* filename) {
+  long n = load_file(filename, bus->charrom, BUS_CHARROM_SIZE);
+  if (n < 0)
+     return 1;
+  if (n != BUS_CHARROM_SIZE) {
+     LOG(LOG_ERROR, "%s should be %d bytes", filename, BUS_CHARROM_SIZE);
+     return 1;
+  }
+  return 0;
+}
+
+void bus_set_bank(struct busmodel* bus, int bank) {
+  bus->bank = (bank & 3) * 0x4000;
+}
@@ -0,0 +1,94 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef VICII_BUSMODEL_H
+#define VICII_BUSMODEL_H
+
+#include <stdint.h>
+
+// Memory as the VIC sees it on a C64 board, for standalone runs
+// without VICE. Serves the VIC's fetches from a 64K RAM image, the
+// 1K x 4 color RAM and the character ROM, with the CIA2 bank
+// selecting which 16K the VIC can see.
+//
+// DRAM is modelled from the VIC's own strobes: the row (A0-A7) is
+// latched from ado on the falling edge of RAS and the column (A8-A13)
+// on the falling edge of CAS, at which point the data for the full
+// address is put on the bus. Char ROM and color RAM see the latched
+// low byte and the unmultiplexed A8-A11 like the real board.
+
+#define BUS_RAM_SIZE     65536
+#define BUS_COLOR_SIZE   1024
+#define BUS_CHARROM_SIZE 4096
+
+struct busmodel {
+  uint8_t ram[BUS_RAM_SIZE];
+  uint8_t color[BUS_COLOR_SIZE];
+  uint8_t charrom[BUS_CHARROM_SIZE];
+  unsigned int bank;  // VIC bank base address
+
+  int ras;       // strobe levels seen last tick
+  int cas;
+  int row;       // A0-A7 latched on RAS
+  uint16_t data; // {color nibble, ram/rom byte} driven on dbh/dbl
+};
+
+struct busmodel* bus_create();
+
+void bus_destroy(struct busmodel* bus);
+
+// Loaders return 1 on error, 0 success.
+
+// PRG file at its two byte load address.
+int bus_load_prg(struct busmodel* bus, const char* filename);
+
+// Raw binary at addr (a 64K RAM dump loads at 0).
+int bus_load_bin(struct busmodel* bus, const char* filename, unsigned int addr);
+
+// 1024 bytes, low nibbles used.
+int bus_load_color(struct busmodel* bus, const char* filename);
+
+// 4096 byte character ROM image.
+int bus_load_charrom(struct busmodel* bus, const char* filename);
+
+// VIC bank 0-3 (bank 0 is $0000-$3fff). CIA2 port A bits 0-1 hold the
+// inverse of this.
+void bus_set_bank(struct busmodel* bus, int bank);
+
+// What the VIC reads at 14 bit address addr in the current bank.
+static inline uint16_t bus_read(struct busmodel* bus, unsigned int addr) {
+  unsigned int full = bus->bank | (addr & 0x3fff);
+  uint8_t val;
+  // Char ROM shows up at $1000-$1fff in banks 0 and 2
+  if ((full & 0x7000) == 0x1000)
+     val = bus->charrom[full & 0xfff];
+  else
+     val = bus->ram[full];
+  return val | ((bus->color[addr & 0x3ff] & 0xf) << 8);
+}
+
+// Call after every eval with the VIC's strobes and address outputs.
+static inline void bus_clock(struct busmodel* bus, int ras, int cas,
+                             unsigned int ado) {
+  if (bus->ras && !ras)
+     bus->row = ado & 0xff;
+  if (bus->cas && !cas)
+     bus->data = bus_read(bus, ((ado & 0x3f) << 8) | bus->row);
+  bus->ras = ras;
+  bus->cas = cas;
+}
+
+#endif
@@ -0,0 +1,82 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef VICII_CLOCKS_H
+#define VICII_CLOCKS_H
+
+#include <stdint.h>
+
+// Clock edge scheduler for the simulator's input clocks.
+//
+// Every clock's half period is a whole number of base units, picked
+// so the ratios between clocks are exact (e.g. dot4x:col16x is 4:9 for
+// PAL). cs_next jumps to the earliest pending edge and reports every
+// clock that has an edge at that instant so coincident edges can be
+// evaluated together. Time is kept in integers and never drifts.
+
+#define CS_MAX_CLOCKS 4
+
+struct clock_sched {
+  int num;
+  uint64_t half[CS_MAX_CLOCKS]; // half period in base units
+  uint64_t next[CS_MAX_CLOCKS]; // next edge in base units
+  uint64_t now;                 // base units
+  uint64_t psNum;               // ps = now * psNum / psDen
+  uint64_t psDen;
+};
+
+static inline void cs_init(struct clock_sched* cs,
+                           uint64_t psNum, uint64_t psDen) {
+  cs->num = 0;
+  cs->now = 0;
+  cs->psNum = psNum;
+  cs->psDen = psDen;
+}
+
+// Returns the clock's bit in the masks returned by cs_next. The first
+// edge is one half period from now.
+static inline int cs_add(struct clock_sched* cs, uint64_t half) {
+  int id = cs->num++;
+  cs->half[id] = half;
+  cs->next[id] = cs->now + half;
+  return id;
+}
+
+// Advance to the next edge. Returns a mask of the clocks that have an
+// edge at the new time.
+static inline unsigned int cs_next(struct clock_sched* cs) {
+  uint64_t t = cs->next[0];
+  for (int i = 1; i < cs->num; i++)
+    if (cs->next[i] < t)
+      t = cs->next[i];
+
+  unsigned int edges = 0;
+  for (int i = 0; i < cs->num; i++) {
+    if (cs->next[i] == t) {
+      edges |= 1 << i;
+      cs->next[i] += cs->half[i];
+    }
+  }
+  cs->now = t;
+  return edges;
+}
+
+// Current time in picoseconds
+static inline uint64_t cs_ps(struct clock_sched* cs) {
+  return cs->now * cs->psNum / cs->psDen;
+}
+
+#endif
@@ -59,6 +59,18 @@
 #define PAL_6569_MAX_DOT_Y 311
 #define PAL_6569_LAST_XPOS 0x1f7
 
+// Where a VICE screenshot (normal borders: 384 pixels starting 32 left
+// of the 40 column window, PAL lines 16-287, NTSC 30-276) sits in a
+// native simulator frame. NTSC frames are drawn 25 lines up. Columns
+// count from cycle 0 and every chip reaches the display window on the
+// same cycle, so X is the same for all three.
+#define PAL_6569_VICE_X 105
+#define PAL_6569_VICE_Y 16
+#define NTSC_6567R8_VICE_X 105
+#define NTSC_6567R8_VICE_Y 5
+#define NTSC_6567R56A_VICE_X 105
+#define NTSC_6567R56A_VICE_Y 5
+
 #define VIC_LP 0
 #define VIC_LPI2 1
 #define VIC_LS2 2
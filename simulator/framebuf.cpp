@@ -0,0 +1,72 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "framebuf.h"
+#include "log.h"
+
+struct framebuf* fb_create(int width, int height) {
+  struct framebuf* fb = (struct framebuf*) malloc(sizeof(struct framebuf));
+  fb->width = width;
+  fb->height = height;
+  fb->pixels = (uint32_t*) calloc(width * height, sizeof(uint32_t));
+  fb->ren = nullptr;
+  fb->tex = nullptr;
+  return fb;
+}
+
+void fb_destroy(struct framebuf* fb) {
+  if (fb->tex)
+     SDL_DestroyTexture(fb->tex);
+  free(fb->pixels);
+  free(fb);
+}
+
+int fb_attach(struct framebuf* fb, SDL_Renderer* ren) {
+  fb->ren = ren;
+  fb->tex = SDL_CreateTexture(ren, SDL_PIXELFORMAT_RGB888,
+                              SDL_TEXTUREACCESS_STREAMING,
+                              fb->width, fb->height);
+  if (fb->tex == nullptr) {
+     LOG(LOG_ERROR, "SDL_CreateTexture %s", SDL_GetError());
+     return 1;
+  }
+  return 0;
+}
+
+void fb_present(struct framebuf* fb) {
+  if (!fb->tex)
+     return;
+  SDL_UpdateTexture(fb->tex, NULL, fb->pixels, fb->width * sizeof(uint32_t));
+  SDL_RenderCopy(fb->ren, fb->tex, NULL, NULL);
+  SDL_RenderPresent(fb->ren);
+}
+
+int fb_save_bmp(struct framebuf* fb, const char* filename) {
+  SDL_Surface *sshot = SDL_CreateRGBSurfaceFrom(fb->pixels,
+      fb->width, fb->height, 32, fb->width * sizeof(uint32_t),
+      0x00ff0000, 0x0000ff00, 0x000000ff, 0);
+  if (sshot == nullptr) {
+     LOG(LOG_ERROR, "SDL_CreateRGBSurfaceFrom %s", SDL_GetError());
+     return 1;
+  }
+  int rc = SDL_SaveBMP(sshot, filename) != 0;
+  SDL_FreeSurface(sshot);
+  return rc;
+}
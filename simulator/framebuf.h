@@ -0,0 +1,64 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef VICII_FRAMEBUF_H
+#define VICII_FRAMEBUF_H
+
+#include <stdint.h>
+
+#include <SDL2/SDL.h>
+
+// A plain in-memory RGB framebuffer the simulator renders into.
+// Pixels are stored as 0x00RRGGBB so the whole buffer can be handed
+// to SDL as a streaming texture (SDL_PIXELFORMAT_RGB888) in a single
+// upload. Nothing here requires SDL video to be initialized, so the
+// same buffer is used for headless runs.
+
+#define FB_RGB(r,g,b) \
+   ((((uint32_t)(r) & 0xff) << 16) | (((uint32_t)(g) & 0xff) << 8) | \
+     ((uint32_t)(b) & 0xff))
+
+struct framebuf {
+  int width;
+  int height;
+  uint32_t* pixels;
+
+  // Only set when presenting to a window.
+  SDL_Renderer* ren;
+  SDL_Texture* tex;
+};
+
+struct framebuf* fb_create(int width, int height);
+
+void fb_destroy(struct framebuf* fb);
+
+// Plot one pixel. Out of range coordinates are ignored.
+static inline void fb_plot(struct framebuf* fb, int x, int y, uint32_t rgb) {
+  if (x < 0 || y < 0 || x >= fb->width || y >= fb->height)
+     return;
+  fb->pixels[y * fb->width + x] = rgb;
+}
+
+// Attach a renderer so fb_present can upload the buffer. Returns 1 on error.
+int fb_attach(struct framebuf* fb, SDL_Renderer* ren);
+
+// One SDL_UpdateTexture + copy + present of the whole buffer.
+void fb_present(struct framebuf* fb);
+
+// Save the buffer as a BMP. Returns 1 on error, 0 success.
+int fb_save_bmp(struct framebuf* fb, const char* filename);
+
+#endif
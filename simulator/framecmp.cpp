@@ -0,0 +1,407 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+// Compare simulator frames with VICE screenshots.
+//
+// Usage: framecmp [options] fpga.png vice.png [fpga.png vice.png ...]
+//
+// Both frames are mapped to palette indices (nearest of the 16 VIC-II
+// colors) so the two palettes don't have to agree. The smaller frame
+// (VICE's visible window) is compared where that window sits in the
+// larger one (the whole raster at the chip's native size, see
+// constants.h). -a gives another offset and -s searches for the best
+// fit instead, e.g. to check the constants.
+// Exits 0 when every pair matches within -t pixels, 1 when one
+// differs, 2 on errors.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <unordered_map>
+#include <vector>
+
+#include "constants.h"
+#include "framefile.h"
+#include "log.h"
+
+// Same colors as native_rgb in sim_main.cpp, scaled the way the
+// simulator renders them.
+static const int palette[16][3] = {
+  {   3,   3,   3 }, { 255, 255, 255 }, { 175,  43,  43 }, {  99, 219, 207 },
+  { 179,  63, 183 }, {  75, 199,  75 }, {  55,  59, 199 }, { 231, 239,  79 },
+  { 183,  91,  31 }, { 107,  59,  11 }, { 235, 119, 111 }, {  79,  79,  79 },
+  { 135, 135, 135 }, { 167, 251, 159 }, { 115, 127, 231 }, { 183, 183, 183 },
+};
+
+struct frame {
+  const char* name;
+  unsigned char* rgb;
+  int width;
+  int height;
+  std::vector<unsigned char> index;
+};
+
+struct result {
+  int offsetX;
+  int offsetY;
+  int width;   // of the compared area
+  int height;
+  long mismatches;
+  std::vector<int> rowMismatches;
+};
+
+static int nearest(int r, int g, int b) {
+  int best = 0;
+  long bestDist = -1;
+  for (int i = 0; i < 16; i++) {
+     long dr = r - palette[i][0];
+     long dg = g - palette[i][1];
+     long db = b - palette[i][2];
+     long dist = 2 * dr * dr + 4 * dg * dg + 3 * db * db;
+     if (bestDist < 0 || dist < bestDist) {
+        best = i;
+        bestDist = dist;
+     }
+  }
+  return best;
+}
+
+static int load(struct frame* f, const char* name) {
+  f->name = name;
+  if (fd_read(name, &f->rgb, &f->width, &f->height))
+     return 1;
+
+  // Frames only use a handful of colors, look each one up once.
+  std::unordered_map<uint32_t, unsigned char> seen;
+  size_t n = (size_t) f->width * f->height;
+  f->index.resize(n);
+  for (size_t i = 0; i < n; i++) {
+     unsigned char* p = f->rgb + i * 3;
+     uint32_t key = (p[0] << 16) | (p[1] << 8) | p[2];
+     auto it = seen.find(key);
+     if (it == seen.end())
+        it = seen.emplace(key, nearest(p[0], p[1], p[2])).first;
+     f->index[i] = it->second;
+  }
+  return 0;
+}
+
+// Raster line shown on row y of a simulator frame of this size. NTSC
+// frames are drawn 25 lines up (see the render code in sim_main.cpp).
+static int raster_line(int width, int height, int y) {
+  if (width == NTSC_6567R8_MAX_DOT_X + 1 &&
+         height == NTSC_6567R8_MAX_DOT_Y + 1)
+     return (y + 25) % height;
+  if (width == NTSC_6567R56A_MAX_DOT_X + 1 &&
+         height == NTSC_6567R56A_MAX_DOT_Y + 1)
+     return (y + 25) % height;
+  return y;
+}
+
+// Where VICE's visible window starts in a simulator frame of this
+// size. False when it isn't a chip's native size.
+static bool vice_window(int width, int height, int* ox, int* oy) {
+  if (width == PAL_6569_MAX_DOT_X + 1 &&
+         height == PAL_6569_MAX_DOT_Y + 1) {
+     *ox = PAL_6569_VICE_X;
+     *oy = PAL_6569_VICE_Y;
+  } else if (width == NTSC_6567R8_MAX_DOT_X + 1 &&
+         height == NTSC_6567R8_MAX_DOT_Y + 1) {
+     *ox = NTSC_6567R8_VICE_X;
+     *oy = NTSC_6567R8_VICE_Y;
+  } else if (width == NTSC_6567R56A_MAX_DOT_X + 1 &&
+         height == NTSC_6567R56A_MAX_DOT_Y + 1) {
+     *ox = NTSC_6567R56A_VICE_X;
+     *oy = NTSC_6567R56A_VICE_Y;
+  } else {
+     return false;
+  }
+  return true;
+}
+
+static long count_mismatches(struct frame* big, struct frame* small,
+                             int ox, int oy, int stepX, int stepY,
+                             long giveUp) {
+  long n = 0;
+  for (int y = 0; y < small->height; y += stepY) {
+     const unsigned char* a = &big->index[(size_t) (y + oy) * big->width + ox];
+     const unsigned char* b = &small->index[(size_t) y * small->width];
+     for (int x = 0; x < small->width; x += stepX)
+        n += a[x] != b[x];
+     if (n > giveUp)
+        break;
+  }
+  return n;
+}
+
+// Where small sits inside big. A coarse grid of samples ranks every
+// offset, the best one is then compared in full.
+static void align(struct frame* big, struct frame* small, int* ox, int* oy) {
+  long best = -1;
+  for (int y = 0; y <= big->height - small->height; y++) {
+     for (int x = 0; x <= big->width - small->width; x++) {
+        long n = count_mismatches(big, small, x, y, 4, 2,
+                                  best < 0 ? small->width * small->height : best);
+        if (best < 0 || n < best) {
+           best = n;
+           *ox = x;
+           *oy = y;
+        }
+     }
+  }
+}
+
+static void compare(struct frame* big, struct frame* small,
+                    int ox, int oy, struct result* r) {
+  r->offsetX = ox;
+  r->offsetY = oy;
+  r->width = small->width;
+  r->height = small->height;
+  r->mismatches = 0;
+  r->rowMismatches.assign(small->height, 0);
+  for (int y = 0; y < small->height; y++) {
+     const unsigned char* a = &big->index[(size_t) (y + oy) * big->width + ox];
+     const unsigned char* b = &small->index[(size_t) y * small->width];
+     int n = 0;
+     for (int x = 0; x < small->width; x++)
+        n += a[x] != b[x];
+     r->rowMismatches[y] = n;
+     r->mismatches += n;
+  }
+}
+
+// One pixel per block x block area. Blocks that match show the VICE
+// frame's color, dimmed. The rest go from dark red (one pixel differs)
+// to yellow (all of them do).
+static int write_heatmap(const char* name, struct frame* big,
+                         struct frame* small, struct result* r, int block) {
+  int w = (r->width + block - 1) / block;
+  int h = (r->height + block - 1) / block;
+  std::vector<unsigned char> rgb((size_t) w * h * 3);
+
+  for (int by = 0; by < h; by++) {
+     for (int bx = 0; bx < w; bx++) {
+        int n = 0, total = 0;
+        for (int y = by * block; y < (by + 1) * block && y < r->height; y++) {
+           for (int x = bx * block; x < (bx + 1) * block && x < r->width; x++) {
+              size_t i = (size_t) (y + r->offsetY) * big->width + x + r->offsetX;
+              n += big->index[i] != small->index[(size_t) y * small->width + x];
+              total++;
+           }
+        }
+
+        unsigned char* o = &rgb[((size_t) by * w + bx) * 3];
+        if (n == 0) {
+           const int* c = palette[small->index[(size_t) by * block * small->width +
+                                               bx * block]];
+           o[0] = c[0] / 4;
+           o[1] = c[1] / 4;
+           o[2] = c[2] / 4;
+        } else {
+           double f = (double) n / total;
+           o[0] = f < 0.5 ? 128 + (int) (254 * f) : 255;
+           o[1] = f < 0.5 ? 0 : (int) (510 * (f - 0.5));
+           o[2] = 0;
+        }
+     }
+  }
+  return fd_write_rgb(name, &rgb[0], w, h);
+}
+
+static void print_lines(struct frame* big, struct result* r) {
+  int most = 1;
+  for (int y = 0; y < r->height; y++)
+     if (r->rowMismatches[y] > most)
+        most = r->rowMismatches[y];
+
+  for (int y = 0; y < r->height; y++) {
+     int n = r->rowMismatches[y];
+     if (n == 0)
+        continue;
+     char bar[61];
+     int len = (n * 60 + most - 1) / most;
+     memset(bar, '#', len);
+     bar[len] = '\0';
+     printf ("  line %3d: %4d %s\n",
+             raster_line(big->width, big->height, y + r->offsetY), n, bar);
+  }
+}
+
+static void print_json(struct frame* big, struct frame* small,
+                       struct result* r, bool pass, bool first) {
+  printf ("%s{\"fpga\": \"%s\", \"vice\": \"%s\", \"offset\": [%d, %d], "
+          "\"size\": [%d, %d], \"mismatches\": %ld, \"match\": %s, "
+          "\"lines\": [",
+          first ? "" : ",\n", big->name, small->name,
+          r->offsetX, r->offsetY, r->width, r->height, r->mismatches,
+          pass ? "true" : "false");
+  const char* sep = "";
+  for (int y = 0; y < r->height; y++) {
+     if (r->rowMismatches[y] == 0)
+        continue;
+     printf ("%s[%d, %d]", sep,
+             raster_line(big->width, big->height, y + r->offsetY),
+             r->rowMismatches[y]);
+     sep = ", ";
+  }
+  printf ("]}");
+}
+
+static void usage() {
+  printf ("Usage: framecmp [options] fpga.png vice.png [fpga.png vice.png ...]\n");
+  printf ("  -a x,y  : the smaller frame starts at x,y in the larger one\n");
+  printf ("            (default: where VICE's window is for the chip)\n");
+  printf ("  -s      : search for the best fit and report where it is\n");
+  printf ("  -t n    : pass with up to n differing pixels (default 0)\n");
+  printf ("  -d file : write a heatmap of the differences (one pair only)\n");
+  printf ("  -b n    : heatmap block size in pixels (default 4)\n");
+  printf ("  -l      : print differing pixels per raster line\n");
+  printf ("  -j      : print results as JSON\n");
+}
+
+int main(int argc, char** argv) {
+  int fixedX = -1, fixedY = -1;
+  long tolerance = 0;
+  const char* heatmap = nullptr;
+  int block = 4;
+  bool lines = false;
+  bool json = false;
+  bool search = false;
+  int c;
+
+  while ((c = getopt(argc, argv, "a:t:d:b:sljh")) != -1) {
+    switch (c) {
+      case 'a':
+        if (sscanf(optarg, "%d,%d", &fixedX, &fixedY) != 2 ||
+               fixedX < 0 || fixedY < 0) {
+          usage();
+          return 2;
+        }
+        break;
+      case 't':
+        tolerance = atol(optarg);
+        break;
+      case 'd':
+        heatmap = optarg;
+        break;
+      case 'b':
+        block = atoi(optarg);
+        if (block < 1) {
+          usage();
+          return 2;
+        }
+        break;
+      case 's':
+        search = true;
+        break;
+      case 'l':
+        lines = true;
+        break;
+      case 'j':
+        json = true;
+        break;
+      default:
+        usage();
+        return c == 'h' ? 0 : 2;
+    }
+  }
+
+  int pairs = (argc - optind) / 2;
+  if (pairs == 0 || (argc - optind) % 2 || (heatmap && pairs > 1)) {
+    usage();
+    return 2;
+  }
+
+  int rc = 0;
+  if (json)
+    printf ("[\n");
+
+  for (int p = 0; p < pairs; p++) {
+    struct frame a, b;
+    if (load(&a, argv[optind + p * 2]) || load(&b, argv[optind + p * 2 + 1])) {
+      rc = 2;
+      break;
+    }
+
+    // Find the frame the other one fits in
+    struct frame* big = &a;
+    struct frame* small = &b;
+    if (b.width >= a.width && b.height >= a.height) {
+      big = &b;
+      small = &a;
+    }
+    if (small->width > big->width || small->height > big->height) {
+      LOG(LOG_ERROR, "%s (%dx%d) and %s (%dx%d) don't overlap", a.name,
+          a.width, a.height, b.name, b.width, b.height);
+      rc = 2;
+      break;
+    }
+    int ox = 0, oy = 0;
+    if (search) {
+      align(big, small, &ox, &oy);
+    } else {
+      if (fixedX >= 0) {
+        ox = fixedX;
+        oy = fixedY;
+      } else if (!vice_window(big->width, big->height, &ox, &oy)) {
+        LOG(LOG_ERROR, "%s is %dx%d, not a chip's native size (use -a or -s)",
+            big->name, big->width, big->height);
+        rc = 2;
+        break;
+      }
+      if (ox + small->width > big->width || oy + small->height > big->height) {
+        LOG(LOG_ERROR, "offset %d,%d puts %s outside %s", ox, oy,
+            small->name, big->name);
+        rc = 2;
+        break;
+      }
+    }
+
+    struct result r;
+    compare(big, small, ox, oy, &r);
+    bool pass = r.mismatches <= tolerance;
+    if (!pass)
+      rc = 1;
+
+    if (json) {
+      print_json(big, small, &r, pass, p == 0);
+    } else {
+      const char* how = search ? "best fit at" : "offset";
+      if (r.mismatches == 0)
+        printf ("%s %s: match (%s %d,%d)\n", big->name, small->name,
+                how, ox, oy);
+      else
+        printf ("%s %s: %ld of %d pixels differ (%s %d,%d)\n",
+                big->name, small->name, r.mismatches,
+                r.width * r.height, how, ox, oy);
+      if (lines)
+        print_lines(big, &r);
+    }
+
+    if (heatmap && write_heatmap(heatmap, big, small, &r, block))
+      rc = 2;
+
+    free(a.rgb);
+    free(b.rgb);
+  }
+
+  if (json)
+    printf ("\n]\n");
+  return rc;
+}
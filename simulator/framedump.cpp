@@ -0,0 +1,53 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "framebuf.h"
+#include "framedump.h"
+
+void fd_downscale(struct framebuf* fb, int width, int height,
+                  unsigned char* rgb) {
+  for (int y = 0; y < height; y++) {
+     uint32_t* src = fb->pixels + (y * fb->height / height) * fb->width;
+     for (int x = 0; x < width; x++) {
+        uint32_t p = src[x * fb->width / width];
+        *rgb++ = (p >> 16) & 0xff;
+        *rgb++ = (p >> 8) & 0xff;
+        *rgb++ = p & 0xff;
+     }
+  }
+}
+
+int fd_write(const char* filename, struct framebuf* fb, int width, int height) {
+  unsigned char* rgb = (unsigned char*) malloc((size_t) width * height * 3);
+  fd_downscale(fb, width, height, rgb);
+  int rc = fd_write_rgb(filename, rgb, width, height);
+  free(rgb);
+  return rc;
+}
+
+int fd_write_numbered(const char* filename, int num,
+                      struct framebuf* fb, int width, int height) {
+  char name[1024];
+  const char* ext = strrchr(filename, '.');
+  int baseLen = ext ? (int) (ext - filename) : (int) strlen(filename);
+  snprintf(name, sizeof(name), "%.*s_%05d%s", baseLen, filename, num,
+           ext ? ext : "");
+  return fd_write(name, fb, width, height);
+}
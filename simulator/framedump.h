@@ -0,0 +1,40 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef VICII_FRAMEDUMP_H
+#define VICII_FRAMEDUMP_H
+
+#include "framefile.h"
+
+struct framebuf;
+
+// Write frames straight from the simulator framebuffer as PNG or PPM.
+// The framebuffer is twice the chip's native resolution in both
+// directions. Frames are point sampled down to width x height which
+// should be the chip's native size (screenWidth x screenHeight).
+
+// Return 1 on error, 0 success
+int fd_write(const char* filename, struct framebuf* fb, int width, int height);
+
+// Same as fd_write but inserts _NNNNN before the file extension.
+int fd_write_numbered(const char* filename, int num,
+                      struct framebuf* fb, int width, int height);
+
+// Point sample fb down to width x height packed RGB (3 bytes per pixel).
+void fd_downscale(struct framebuf* fb, int width, int height,
+                  unsigned char* rgb);
+
+#endif
@@ -0,0 +1,272 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zlib.h>
+
+#include "framefile.h"
+#include "log.h"
+
+int fd_format_for(const char* filename) {
+  const char* ext = strrchr(filename, '.');
+  if (ext && strcasecmp(ext, ".ppm") == 0)
+     return FD_FORMAT_PPM;
+  return FD_FORMAT_PNG;
+}
+
+static int write_ppm(FILE* fo, unsigned char* rgb, int width, int height) {
+  fprintf(fo, "P6\n%d %d\n255\n", width, height);
+  size_t len = (size_t) width * height * 3;
+  return fwrite(rgb, 1, len, fo) != len;
+}
+
+static void put32(unsigned char* b, uint32_t v) {
+  b[0] = v >> 24;
+  b[1] = v >> 16;
+  b[2] = v >> 8;
+  b[3] = v;
+}
+
+static int write_chunk(FILE* fo, const char* type,
+                       unsigned char* data, uint32_t len) {
+  unsigned char hdr[8];
+  put32(hdr, len);
+  memcpy(hdr + 4, type, 4);
+  uLong crc = crc32(0L, hdr + 4, 4);
+  if (len)
+     crc = crc32(crc, data, len);
+  unsigned char tail[4];
+  put32(tail, crc);
+  if (fwrite(hdr, 1, 8, fo) != 8) return 1;
+  if (len && fwrite(data, 1, len, fo) != len) return 1;
+  if (fwrite(tail, 1, 4, fo) != 4) return 1;
+  return 0;
+}
+
+static int write_png(FILE* fo, unsigned char* rgb, int width, int height) {
+  static const unsigned char sig[8] =
+     { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+  if (fwrite(sig, 1, 8, fo) != 8)
+     return 1;
+
+  unsigned char ihdr[13];
+  put32(ihdr, width);
+  put32(ihdr + 4, height);
+  ihdr[8] = 8;  // bit depth
+  ihdr[9] = 2;  // truecolor RGB
+  ihdr[10] = 0; // deflate
+  ihdr[11] = 0; // adaptive filtering
+  ihdr[12] = 0; // no interlace
+  if (write_chunk(fo, "IHDR", ihdr, 13))
+     return 1;
+
+  // Each scanline is prefixed with filter type 0 (none).
+  int stride = width * 3;
+  uLong rawLen = (uLong) (stride + 1) * height;
+  unsigned char* raw = (unsigned char*) malloc(rawLen);
+  for (int y = 0; y < height; y++) {
+     raw[y * (stride + 1)] = 0;
+     memcpy(raw + y * (stride + 1) + 1, rgb + y * stride, stride);
+  }
+
+  uLongf zLen = compressBound(rawLen);
+  unsigned char* z = (unsigned char*) malloc(zLen);
+  int rc = compress2(z, &zLen, raw, rawLen, Z_BEST_SPEED) != Z_OK;
+  if (!rc)
+     rc = write_chunk(fo, "IDAT", z, zLen);
+  if (!rc)
+     rc = write_chunk(fo, "IEND", nullptr, 0);
+  free(z);
+  free(raw);
+  return rc;
+}
+
+int fd_write_rgb(const char* filename, unsigned char* rgb,
+                 int width, int height) {
+  FILE* fo = fopen(filename, "wb");
+  if (fo == nullptr) {
+     LOG(LOG_ERROR, "can't open %s", filename);
+     return 1;
+  }
+
+  int rc;
+  if (fd_format_for(filename) == FD_FORMAT_PPM)
+     rc = write_ppm(fo, rgb, width, height);
+  else
+     rc = write_png(fo, rgb, width, height);
+
+  if (fclose(fo) != 0)
+     rc = 1;
+  if (rc)
+     LOG(LOG_ERROR, "failed writing %s", filename);
+  return rc;
+}
+
+static uint32_t get32(const unsigned char* b) {
+  return ((uint32_t) b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+}
+
+static int read_ppm(FILE* fi, unsigned char** rgb, int* width, int* height) {
+  int maxval;
+  if (fscanf(fi, "P6 %d %d %d", width, height, &maxval) != 3 ||
+         maxval != 255 || fgetc(fi) == EOF ||
+         *width <= 0 || *height <= 0)
+     return 1;
+  size_t len = (size_t) *width * *height * 3;
+  *rgb = (unsigned char*) malloc(len);
+  return fread(*rgb, 1, len, fi) != len;
+}
+
+static int paeth(int a, int b, int c) {
+  int p = a + b - c;
+  int pa = abs(p - a);
+  int pb = abs(p - b);
+  int pc = abs(p - c);
+  if (pa <= pb && pa <= pc) return a;
+  if (pb <= pc) return b;
+  return c;
+}
+
+static int read_png(FILE* fi, unsigned char** rgb, int* width, int* height) {
+  unsigned char hdr[8];
+  unsigned char ihdr[13] = { 0 };
+  unsigned char plte[256 * 3] = { 0 };
+  unsigned char* idat = nullptr;
+  size_t idatLen = 0;
+
+  // Gather IHDR, PLTE and the IDAT stream. CRCs aren't checked.
+  while (fread(hdr, 1, 8, fi) == 8) {
+     uint32_t len = get32(hdr);
+     if (len > (1u << 30))
+        break;
+     unsigned char* data = (unsigned char*) malloc(len + 4);
+     if (fread(data, 1, len + 4, fi) != len + 4) {
+        free(data);
+        break;
+     }
+     if (memcmp(hdr + 4, "IHDR", 4) == 0 && len == 13)
+        memcpy(ihdr, data, 13);
+     else if (memcmp(hdr + 4, "PLTE", 4) == 0 && len <= sizeof(plte))
+        memcpy(plte, data, len);
+     else if (memcmp(hdr + 4, "IDAT", 4) == 0) {
+        idat = (unsigned char*) realloc(idat, idatLen + len);
+        memcpy(idat + idatLen, data, len);
+        idatLen += len;
+     }
+     bool end = memcmp(hdr + 4, "IEND", 4) == 0;
+     free(data);
+     if (end)
+        break;
+  }
+
+  *width = get32(ihdr);
+  *height = get32(ihdr + 4);
+  int depth = ihdr[8];
+  int type = ihdr[9];
+  int channels = type == 0 ? 1 : type == 2 ? 3 : type == 3 ? 1 :
+                 type == 4 ? 2 : type == 6 ? 4 : 0;
+  if (idat == nullptr || *width <= 0 || *height <= 0 || channels == 0 ||
+         ihdr[12] != 0 || (depth != 8 && !(type == 3 && depth < 8))) {
+     free(idat);
+     return 1;
+  }
+
+  // Bytes per pixel for filtering (at least 1) and per scanline
+  int bpp = depth == 8 ? channels : 1;
+  size_t stride = ((size_t) *width * channels * depth + 7) / 8;
+  uLongf rawLen = (stride + 1) * *height;
+  unsigned char* raw = (unsigned char*) malloc(rawLen);
+  int rc = uncompress(raw, &rawLen, idat, idatLen) != Z_OK ||
+           rawLen != (stride + 1) * *height;
+  free(idat);
+
+  unsigned char* prev = nullptr;
+  for (int y = 0; !rc && y < *height; y++) {
+     unsigned char* line = raw + y * (stride + 1);
+     int filter = line[0];
+     line++;
+     for (size_t i = 0; i < stride; i++) {
+        int a = i >= (size_t) bpp ? line[i - bpp] : 0;
+        int b = prev ? prev[i] : 0;
+        int c = prev && i >= (size_t) bpp ? prev[i - bpp] : 0;
+        switch (filter) {
+           case 0: break;
+           case 1: line[i] += a; break;
+           case 2: line[i] += b; break;
+           case 3: line[i] += (a + b) / 2; break;
+           case 4: line[i] += paeth(a, b, c); break;
+           default: rc = 1; break;
+        }
+     }
+     prev = line;
+  }
+
+  if (!rc) {
+     unsigned char* out = (unsigned char*) malloc((size_t) *width * *height * 3);
+     unsigned char* o = out;
+     for (int y = 0; y < *height; y++) {
+        unsigned char* line = raw + y * (stride + 1) + 1;
+        for (int x = 0; x < *width; x++, o += 3) {
+           if (type == 3) {
+              int shift = 8 - depth - (x * depth) % 8;
+              int index = (line[x * depth / 8] >> shift) & ((1 << depth) - 1);
+              memcpy(o, plte + index * 3, 3);
+           } else if (channels <= 2) {
+              o[0] = o[1] = o[2] = line[x * channels];
+           } else {
+              memcpy(o, line + x * channels, 3);
+           }
+        }
+     }
+     *rgb = out;
+  }
+  free(raw);
+  return rc;
+}
+
+int fd_read(const char* filename, unsigned char** rgb,
+            int* width, int* height) {
+  static const unsigned char sig[8] =
+     { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+  FILE* fi = fopen(filename, "rb");
+  if (fi == nullptr) {
+     LOG(LOG_ERROR, "can't open %s", filename);
+     return 1;
+  }
+
+  *rgb = nullptr;
+  unsigned char magic[8];
+  int rc = 1;
+  if (fread(magic, 1, 8, fi) == 8 && memcmp(magic, sig, 8) == 0) {
+     rc = read_png(fi, rgb, width, height);
+  } else if (memcmp(magic, "P6", 2) == 0) {
+     rewind(fi);
+     rc = read_ppm(fi, rgb, width, height);
+  }
+  fclose(fi);
+
+  if (rc) {
+     free(*rgb);
+     *rgb = nullptr;
+     LOG(LOG_ERROR, "can't read %s (need PNG or binary PPM)", filename);
+  }
+  return rc;
+}
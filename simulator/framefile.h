@@ -0,0 +1,39 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef VICII_FRAMEFILE_H
+#define VICII_FRAMEFILE_H
+
+// Read and write packed RGB frames (3 bytes per pixel) as PNG or PPM.
+// Only needs zlib, so tools like framecmp build without SDL.
+
+#define FD_FORMAT_PPM 0
+#define FD_FORMAT_PNG 1
+
+// Pick a format from the file extension. Defaults to PNG.
+int fd_format_for(const char* filename);
+
+// Write packed RGB as PNG or PPM. Return 1 on error, 0 success
+int fd_write_rgb(const char* filename, unsigned char* rgb,
+                 int width, int height);
+
+// Read a PNG (8 bit gray/RGB/RGBA or palette, not interlaced) or a
+// binary PPM into packed RGB. *rgb is malloc'd, the caller frees it.
+// Return 1 on error, 0 success
+int fd_read(const char* filename, unsigned char** rgb,
+            int* width, int* height);
+
+#endif
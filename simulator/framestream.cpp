@@ -0,0 +1,167 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "framedump.h"
+#include "framestream.h"
+#include "log.h"
+
+struct framestream {
+  FILE* fo;
+  bool isPipe;
+  bool isY4M;
+  int width;
+  int height;
+  int written;
+  bool failed;
+
+  std::mutex lock;
+  std::condition_variable notEmpty;
+  std::condition_variable notFull;
+  std::deque<std::vector<unsigned char> > queue;
+  bool closing;
+  std::thread writer;
+};
+
+// BT.601 full range RGB -> YUV 4:4:4 planes
+static void write_y4m_frame(struct framestream* fs, unsigned char* rgb,
+                            std::vector<unsigned char>& yuv) {
+  int n = fs->width * fs->height;
+  yuv.resize(n * 3);
+  unsigned char* py = &yuv[0];
+  unsigned char* pu = py + n;
+  unsigned char* pv = pu + n;
+  for (int i = 0; i < n; i++) {
+     int r = rgb[i*3];
+     int g = rgb[i*3+1];
+     int b = rgb[i*3+2];
+     py[i] = (unsigned char) ((  77*r + 150*g +  29*b + 128) >> 8);
+     pu[i] = (unsigned char) (((-43*r -  85*g + 128*b + 128) >> 8) + 128);
+     pv[i] = (unsigned char) (((128*r - 107*g -  21*b + 128) >> 8) + 128);
+  }
+  if (fputs("FRAME\n", fs->fo) < 0 ||
+      fwrite(&yuv[0], 1, yuv.size(), fs->fo) != yuv.size())
+     fs->failed = true;
+}
+
+static void writer_main(struct framestream* fs) {
+  std::vector<unsigned char> yuv;
+  while (true) {
+     std::vector<unsigned char> frame;
+     {
+        std::unique_lock<std::mutex> guard(fs->lock);
+        while (fs->queue.empty() && !fs->closing)
+           fs->notEmpty.wait(guard);
+        if (fs->queue.empty())
+           return;
+        frame.swap(fs->queue.front());
+        fs->queue.pop_front();
+     }
+     fs->notFull.notify_one();
+
+     if (fs->failed)
+        continue;
+
+     if (fs->isY4M) {
+        write_y4m_frame(fs, &frame[0], yuv);
+     } else if (fwrite(&frame[0], 1, frame.size(), fs->fo) != frame.size()) {
+        fs->failed = true;
+     }
+
+     if (fs->failed) {
+        LOG(LOG_ERROR, "frame stream write failed after %d frames",
+            fs->written);
+     } else {
+        fs->written++;
+     }
+  }
+}
+
+struct framestream* fs_open(const char* target, int width, int height,
+                            int fps) {
+  struct framestream* fs = new framestream();
+  fs->width = width;
+  fs->height = height;
+  fs->written = 0;
+  fs->failed = false;
+  fs->closing = false;
+  fs->isPipe = target[0] == '|';
+
+  const char* ext = strrchr(target, '.');
+  fs->isY4M = !fs->isPipe && ext && strcasecmp(ext, ".y4m") == 0;
+
+  if (fs->isPipe)
+     fs->fo = popen(target + 1, "w");
+  else
+     fs->fo = fopen(target, "wb");
+
+  if (fs->fo == nullptr) {
+     LOG(LOG_ERROR, "can't open frame stream %s", target);
+     delete fs;
+     return nullptr;
+  }
+
+  if (fs->isY4M) {
+     fprintf(fs->fo, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n",
+             width, height, fps);
+  }
+
+  LOG(LOG_INFO, "streaming %dx%d frames to %s", width, height, target);
+
+  fs->writer = std::thread(writer_main, fs);
+  return fs;
+}
+
+void fs_push(struct framestream* fs, struct framebuf* fb) {
+  std::vector<unsigned char> frame(fs->width * fs->height * 3);
+  fd_downscale(fb, fs->width, fs->height, &frame[0]);
+
+  {
+     std::unique_lock<std::mutex> guard(fs->lock);
+     while (fs->queue.size() >= FS_MAX_QUEUED)
+        fs->notFull.wait(guard);
+     fs->queue.push_back(std::vector<unsigned char>());
+     fs->queue.back().swap(frame);
+  }
+  fs->notEmpty.notify_one();
+}
+
+int fs_close(struct framestream* fs) {
+  {
+     std::unique_lock<std::mutex> guard(fs->lock);
+     fs->closing = true;
+  }
+  fs->notEmpty.notify_one();
+  fs->writer.join();
+
+  if (fs->isPipe)
+     pclose(fs->fo);
+  else
+     fclose(fs->fo);
+
+  int written = fs->written;
+  delete fs;
+  return written;
+}
@@ -0,0 +1,50 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef VICII_FRAMESTREAM_H
+#define VICII_FRAMESTREAM_H
+
+#include "framebuf.h"
+
+// Streams a sequence of frames to a file or pipe. Frames are copied
+// (downscaled to native resolution) on the simulation thread and
+// written out by a background thread so the eval loop never waits
+// on disk I/O.
+//
+// Target formats:
+//    name.y4m   - YUV4MPEG2 stream (4:4:4), playable by ffmpeg/mpv
+//    |command   - raw RGB24 frames piped into command's stdin
+//    anything   - raw RGB24 frames, back to back
+//
+// Raw streams have no header. Every frame is width*height*3 bytes.
+
+struct framestream;
+
+// Returns nullptr on error.
+struct framestream* fs_open(const char* target, int width, int height,
+                            int fps);
+
+// Queue the current contents of fb. Blocks only if the writer has
+// fallen more than FS_MAX_QUEUED frames behind.
+void fs_push(struct framestream* fs, struct framebuf* fb);
+
+// Drain pending frames, stop the writer and close the target.
+// Returns the number of frames written.
+int fs_close(struct framestream* fs);
+
+#define FS_MAX_QUEUED 64
+
+#endif
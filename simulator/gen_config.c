@@ -55,6 +55,7 @@ enum DefineValues {
    WITH_BLITTER,         // include blitter
    LUMACODE,        // include lumacode
    EFINIX,
+   NATIVE_VIDEO,         // (for simulator) export pixel_color3 when there is no video output
 };
 
 Define defines[] = {
@@ -80,6 +81,7 @@ Define defines[] = {
   {WITH_BLITTER ,0,0,"WITH_BLITTER"},
   {LUMACODE ,0,0,"LUMACODE"},
   {EFINIX ,0,0,"EFINIX"},
+  {NATIVE_VIDEO ,0,0,"NATIVE_VIDEO"},
 };
 
 void printcfg(int d, int def) {
@@ -120,6 +122,7 @@ void with_math(int d) { printcfg(d, WITH_MATH); with_ext(d); }
 void with_blitter(int d) { printcfg(d, WITH_BLITTER); hires_modes(d); with_64k(d); with_math(d);}
 void lumacode(int d) { printcfg(d, LUMACODE); }
 void efinix(int d) { printcfg(d, EFINIX); is_efinix = 1;}
+void native_video(int d) { printcfg(d, NATIVE_VIDEO); }
 
 int main(int argc, char* argv[]) {
 
@@ -251,6 +254,16 @@ int main(int argc, char* argv[]) {
                     efinix(d);
 		    break;
 
+            // FAST REGRESSION
+	    case 11:
+                    // Only what the test suite compares: the pixel
+                    // sequencer's native colors (delayed a raster line
+                    // in top.v to match config 1's RGB frames) and the
+                    // bus signals. Without luma/chroma the simulator
+                    // doesn't have to clock col16x at all. Run with -k.
+		    native_video(d);
+		    break;
+
 	    default:
 		    break;
 
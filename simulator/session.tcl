@@ -62,4 +62,7 @@ lappend pickedsigs "top.vic_inst.ado"
 #lappend pickedsigs "top.dvi_tx0.serializer.tmds_shift_0"
 
 
+# Works for session.fst and session.vcd. Signals below a reduced
+# --trace-depth are simply missing from the dump and get skipped.
 set num_added [ gtkwave::addSignalsFromList $pickedsigs ]
+puts "$num_added of [ llength $pickedsigs ] signals found in $dumpname"
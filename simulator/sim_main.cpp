@@ -19,40 +19,65 @@
 #include <iostream>
 
 #include <ctype.h>
+#include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <verilated.h>
 #include <regex.h>
 
 #include "Vtop.h"
+#include "clocks.h"
 #include "constants.h"
 
 #if VM_TRACE
+#if SIM_TRACE_FST
+#include <verilated_fst_c.h>
+typedef VerilatedFstC TraceC;
+#define TRACE_EXT "fst"
+#else
 #include <verilated_vcd_c.h>
+typedef VerilatedVcdC TraceC;
+#define TRACE_EXT "vcd"
+#endif
+#endif
+#if SIM_SAVABLE
+#include <verilated_save.h>
 #endif
 
 extern "C" {
 #include "vicii_ipc.h"
 }
 #include "log.h"
+#include "framebuf.h"
+#include "framedump.h"
+#include "framestream.h"
+#include "tracering.h"
+#include "busmodel.h"
+#include "vsf.h"
+#include "stimtrace.h"
+#include "simprof.h"
 // Current simulation time (64-bit unsigned). See
 // constants.h for how much each tick represents.
 static vluint64_t ticks = 0;
 static vluint64_t half4XDotPS;
-static vluint64_t half16XColPS;
 static vluint64_t startTicks;
 static vluint64_t endTicks;
-static vluint64_t nextClk;
-static vluint64_t next16XColClk;
-static double col4xClk;
-static double col16xClk;
 static int nextClkCnt;
+static vluint64_t dot4xTicks;
 static int screenWidth;
 static int screenHeight;
 static int lastXPos;
 static int numCycles;
+static struct trace_ring* ring;
+static struct stimtrace* stimRec;
+static struct stimtrace* stimPlay;
+
+// How long --wait-frame gives VICE to announce its first frame before
+// taking it for a VICE without the announce hook
+#define ANNOUNCE_GRACE_S 5
 
 // Some utility macros
 // Use RISING/FALLING in combination with HASCHANGED
@@ -167,9 +192,56 @@ static void HEADER(Vtop *top) {
   );
 }
 
+// Same fields as STATE but as a binary record. See tracering.h.
+static void RECORD(Vtop *top) {
+   struct trace_rec* r = tr_next(ring);
+   r->ticks = ticks;
+   r->xpos = top->V_XPOS;
+   r->raster_x = top->V_RASTER_X;
+   r->raster_line = top->V_RASTER_LINE;
+   r->raster_line_d = top->V_RASTER_LINE_D;
+   r->adi = top->adl;
+   r->ado = top->V_ADO;
+   r->dbo = top->V_DBO;
+   r->vicaddr = top->V_VICADDR;
+   r->pps = top->V_PPS;
+   r->dbi = top->V_DBI;
+   r->cycle_num = top->V_CYCLE_NUM;
+   r->cycle_bit = top->V_CYCLE_BIT;
+   r->cycle_type = top->V_CYCLE_TYPE;
+   r->clk_cnt = nextClkCnt;
+   r->refc = top->V_REFC;
+   r->rc = top->V_RC;
+   r->sprite_mc0 = top->V_SPRITE_MC[0];
+   r->sprite_mcbase0 = top->V_SPRITE_MCBASE[0];
+   r->pad = 0;
+   r->flags =
+      (top->V_DOT4X ? TR_DOT4X : 0) |
+      (HASCHANGED(OUT_DOT) && RISING(OUT_DOT) ? TR_DOT_RISING : 0) |
+      (top->V_CLK_DOT & 8 ? TR_DOTR : 0) |
+      (top->clk_phi ? TR_PHI : 0) |
+      (top->irq ? TR_IRQ : 0) |
+      (top->ba ? TR_BA : 0) |
+      (top->aec ? TR_AEC : 0) |
+      (top->ras ? TR_RAS : 0) |
+      (top->cas ? TR_CAS : 0) |
+      (top->rw ? TR_RW : 0) |
+      (top->ce ? TR_CE : 0) |
+      (top->V_BADLINE ? TR_BADLINE : 0) |
+      (top->V_BMM ? TR_BMM : 0) |
+      (top->V_RST ? TR_RST : 0);
+   tr_commit(ring);
+}
+
 static void STATE(Vtop *top) {
    if ((top->V_DOT4X & 1) == 0) return;
 
+   // With a trace ring, records go there instead of the log.
+   if (ring) {
+      RECORD(top);
+      return;
+   }
+
    if(HASCHANGED(OUT_DOT) && RISING(OUT_DOT))
       HEADER(top);
 
@@ -266,343 +338,1079 @@ static void STORE_PREV() {
 }
 
 
-static void CHECK(Vtop *top, int cond, int line) {
-  if (!cond) {
-     printf ("FAIL line %d:", line);
-     STATE(top);
-     exit(-1);
+#if VM_TRACE
+// Waveform tracing (-t). Without triggers the whole run is dumped to
+// session.fst (session.vcd for TRACE=vcd builds).
+//
+// With --trigger, the dump is written in segments of --pre uS. Each
+// time a segment fills up it is renamed to session_pre.<ext> and a new
+// one is started, so at most two segments exist at any time. Once a
+// trigger fires, tracing carries on for --post uS and then stops. The
+// trigger is in session.<ext>; anything older than the start of that
+// segment is in session_pre.<ext>.
+
+#define TRACE_FILE     "session." TRACE_EXT
+#define TRACE_PRE_FILE "session_pre." TRACE_EXT
+
+#define TRIG_LINE    0  // raster line (and xpos) reached
+#define TRIG_REG     1  // CPU write to a register
+#define TRIG_BADLINE 2  // badline rising edge
+#define TRIG_CHECK   3  // CHECK failure
+
+#define MAX_TRIGGERS 8
+
+struct trigger {
+  int type;
+  int line;
+  int xpos;  // -1 for any
+  int reg;
+};
+
+static TraceC* tfp;
+static int traceDepth = 99;
+static struct trigger triggers[MAX_TRIGGERS];
+static int numTriggers;
+static vluint64_t tracePreTicks = US_TO_TICKS(100L);
+static vluint64_t tracePostTicks = US_TO_TICKS(100L);
+static vluint64_t segmentStart;
+static vluint64_t traceStop;
+static bool triggered;
+static int prevBadline;
+
+// line:L[:X], reg:A, badline or check
+static int parse_trigger(const char* spec) {
+  if (numTriggers == MAX_TRIGGERS) {
+     LOG(LOG_ERROR, "too many triggers");
+     return 1;
+  }
+
+  struct trigger* t = &triggers[numTriggers];
+  t->xpos = -1;
+  if (sscanf(spec, "line:%i:%i", &t->line, &t->xpos) >= 1) {
+     t->type = TRIG_LINE;
+  } else if (sscanf(spec, "reg:%i", &t->reg) == 1 &&
+                t->reg >= 0 && t->reg <= 0x3f) {
+     t->type = TRIG_REG;
+  } else if (strcmp(spec, "badline") == 0) {
+     t->type = TRIG_BADLINE;
+  } else if (strcmp(spec, "check") == 0) {
+     t->type = TRIG_CHECK;
+  } else {
+     LOG(LOG_ERROR, "bad trigger %s", spec);
+     return 1;
   }
+  numTriggers++;
+  return 0;
 }
 
-// We can drive our simulated clock gen every pico second but that would
-// be a waste since nothing happens between clock edges. This function
-// will determine how many ticks(picoseconds) to advance our clock.
+static void trace_open(Vtop* top) {
+  Verilated::traceEverOn(true);  // Verilator must compute traced signals
+  tfp = new TraceC;
+  top->trace(tfp, traceDepth);
+  tfp->open(TRACE_FILE);
+  segmentStart = ticks;
+  remove(TRACE_PRE_FILE);
+  LOG(LOG_INFO, "verilog tracing %d levels into %s", traceDepth, TRACE_FILE);
+}
 
-// tick_scale_* simulates a clk_dvi signal that is slower in the right
-// fraction of the master dot4x clock.  For efinix, we use a slower clock
-// (13/16 for NTSC and 15/16 for PAL) and chop off some of the border area.
-// For spartan, the full resolution is used so clk_dot4x = clk_dvi.
+static void trace_close() {
+  if (!tfp) return;
+  tfp->close();
+  delete tfp;
+  tfp = nullptr;
+}
 
-#ifdef EFINIX
-#ifdef WITH_DVI
-static long tc = 0;
+static void trace_dump(vluint64_t t) {
+  if (tfp) tfp->dump(t / TICKS_TO_TIMESCALE);
+}
+
+static void trace_fire(Vtop* top, const char* why) {
+  triggered = true;
+  traceStop = ticks + tracePostTicks;
+  LOG(LOG_INFO, "trace trigger %s at line %d xpos %x", why,
+      top->V_RASTER_LINE, top->V_XPOS);
+}
+
+// Check triggers and rotate or end the trace window. Call once per
+// tick after dumping.
+static void trace_poll(Vtop* top) {
+  if (!tfp || numTriggers == 0) return;
+
+  if (triggered) {
+     if (ticks >= traceStop) {
+        LOG(LOG_INFO, "trace window done");
+        trace_close();
+     }
+     return;
+  }
+
+  int badline = top->V_BADLINE;
+  for (int i = 0; i < numTriggers && !triggered; i++) {
+     struct trigger* t = &triggers[i];
+     switch (t->type) {
+        case TRIG_LINE:
+           if (top->V_RASTER_LINE == t->line &&
+                  (t->xpos < 0 || top->V_XPOS == t->xpos))
+              trace_fire(top, "line");
+           break;
+        case TRIG_REG:
+           if (!top->ce && !top->rw && top->clk_phi && top->adl == t->reg)
+              trace_fire(top, "reg");
+           break;
+        case TRIG_BADLINE:
+           if (badline && !prevBadline)
+              trace_fire(top, "badline");
+           break;
+        default:
+           break;
+     }
+  }
+  prevBadline = badline;
+
+  if (!triggered && ticks - segmentStart >= tracePreTicks) {
+     tfp->close();
+     rename(TRACE_FILE, TRACE_PRE_FILE);
+     tfp->open(TRACE_FILE);
+     segmentStart = ticks;
+  }
+}
+#endif
+
+// Invariants checked while the model runs. Each one has a name (for
+// --check-policy and the reports), hit/fail counters and a policy for what a
+// failure does. Build with CHECKS=n (SIM_NO_CHECKS) to leave them out.
+
+enum {
+  CHK_SYNC_PHI,       // phi high and dot4x low right after a VICE sync
+  CHK_BUS_PHI,        // VICE bus accesses land in phi high
+  CHK_AEC_LOW,        // aec is low in the first phase
+  CHK_XPOS_ROLLOVER,  // xpos wraps to 0 at cycle 12
+  CHK_XPOS_RESET,     // xpos at cycle 0
+  CHK_XPOS_REPEAT,    // 6567R8 repeats xpos 0x184 at cycles 61/62
+  NUM_CHECKS
+};
+
+#define CHECK_ABORT 0  // report and stop the run (default)
+#define CHECK_ONCE  1  // report the first failure, count the rest
+#define CHECK_COUNT 2  // only count
+
+struct check {
+  const char* name;
+  int policy;
+  vluint64_t hits;
+  vluint64_t fails;
+  // where it failed first
+  vluint64_t firstTicks;
+  int firstLine;
+  int firstCycle;
+  int firstXpos;
+};
+
+static struct check checks[NUM_CHECKS] = {
+  { "sync-phi" },
+  { "bus-phi" },
+  { "aec-low" },
+  { "xpos-rollover" },
+  { "xpos-reset" },
+  { "xpos-repeat" },
+};
+
+// Ring records shown with a failure
+static int checkHistory = 32;
+
+// policy, or name=policy, comma separated. Later ones win.
+static int parse_check_policy(const char* spec) {
+  static const char* policies[] = { "abort", "once", "count" };
+  char buf[256];
+  snprintf(buf, sizeof(buf), "%s", spec);
+
+  for (char* item = strtok(buf, ","); item; item = strtok(nullptr, ",")) {
+    char* eq = strchr(item, '=');
+    const char* policy = eq ? eq + 1 : item;
+    if (eq)
+      *eq = '\0';
+
+    int p = 0;
+    while (p < 3 && strcmp(policy, policies[p]) != 0)
+      p++;
+    if (p == 3) {
+      LOG(LOG_ERROR, "bad check policy %s (abort, once or count)", policy);
+      return 1;
+    }
+
+    bool found = false;
+    for (int i = 0; i < NUM_CHECKS; i++) {
+      if (!eq || strcmp(item, checks[i].name) == 0) {
+        checks[i].policy = p;
+        found = true;
+      }
+    }
+    if (!found) {
+      LOG(LOG_ERROR, "unknown check %s", item);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+#if !SIM_NO_CHECKS
+static void check_failed(Vtop *top, int id, int line) {
+  struct check* c = &checks[id];
+  if (c->fails++ == 0) {
+    c->firstTicks = ticks;
+    c->firstLine = top->V_RASTER_LINE;
+    c->firstCycle = top->V_CYCLE_NUM;
+    c->firstXpos = top->V_XPOS;
+  } else if (c->policy != CHECK_ABORT) {
+    return;
+  }
+  if (c->policy == CHECK_COUNT)
+    return;
+
+  printf ("FAIL %s (line %d) at raster line %d cycle %d xpos %03x:",
+          c->name, line, top->V_RASTER_LINE, top->V_CYCLE_NUM, top->V_XPOS);
+  STATE(top);
+
+  // The ticks leading up to it
+  if (ring) {
+    uint64_t n = tr_size(ring);
+    uint64_t first = n > (uint64_t) checkHistory ? n - checkHistory : 0;
+    printf ("\n");
+    tr_print_header(stdout);
+    for (uint64_t i = first; i < n; i++)
+      tr_print(stdout, tr_get(ring, i));
+  }
+
+#if VM_TRACE
+  if (c->policy != CHECK_ABORT) {
+    // Keep running; a check trigger opens the window here.
+    for (int i = 0; i < numTriggers && tfp && !triggered; i++)
+      if (triggers[i].type == TRIG_CHECK)
+        trace_fire(top, c->name);
+    return;
+  }
+
+  // Leave a readable dump behind. This is the end of the window
+  // for --trigger check.
+  if (tfp) {
+    trace_dump(ticks);
+    trace_close();
+    LOG(LOG_INFO, "trace up to the failure is in %s", TRACE_FILE);
+  }
+#else
+  if (c->policy != CHECK_ABORT)
+    return;
+#endif
+  // The stimulus up to here replays the failure without VICE
+  if (stimRec)
+    st_close(stimRec);
+  exit(-1);
+}
+#endif
+
+// Counters at the end of a run. Returns the number of failures.
+static vluint64_t check_report() {
+  vluint64_t failed = 0;
+  for (int i = 0; i < NUM_CHECKS; i++)
+    failed += checks[i].fails;
+
+#if !SIM_NO_CHECKS
+  int level = failed ? LOG_ERROR : LOG_INFO;
+  for (int i = 0; i < NUM_CHECKS; i++) {
+    struct check* c = &checks[i];
+    if (c->fails) {
+      LOG(level, "check %-14s %llu of %llu failed, first at raster line "
+          "%d cycle %d xpos %03x (%llu ns)", c->name,
+          (unsigned long long) c->fails, (unsigned long long) c->hits,
+          c->firstLine, c->firstCycle, c->firstXpos,
+          (unsigned long long) (c->firstTicks / TICKS_TO_TIMESCALE));
+    } else {
+      LOG(level, "check %-14s %llu passed", c->name,
+          (unsigned long long) c->hits);
+    }
+  }
+#endif
+  return failed;
+}
+
+#if SIM_NO_CHECKS
+#define CHECK(top, id, cond) do { } while (0)
+#else
+#define CHECK(top, id, cond) do { \
+    checks[id].hits++; \
+    if (!(cond)) \
+      check_failed(top, id, __LINE__); \
+  } while (0)
+#endif
+
+// We can drive our simulated clock gen every pico second but that would
+// be a waste since nothing happens between clock edges. The scheduler
+// hands us one edge time after another (see clocks.h).
+
+// dot4x and col16x both derive from the color crystal. One dot4x half
+// period is exactly 9/4 col16x half periods for PAL and 7/4 for NTSC.
+#define COL16X_PER_4_DOT4X_PAL  9
+#define COL16X_PER_4_DOT4X_NTSC 7
+
+// col16x only feeds comp_sync's luma/chroma and the Efinix address
+// generator. clk_dvi only exists on Efinix DVI builds. col4x isn't used
+// by the design at all. Clocks nothing can observe are not scheduled.
+#if defined(GEN_LUMA_CHROMA) || defined(EFINIX)
+#define SIM_CLK_COL16X 1
+#endif
+#if defined(EFINIX) && defined(WITH_DVI)
+#define SIM_CLK_DVI 1
+#endif
 
-// The fraction of dot4x to dviclk changes between our two
-// alternate PAL clocks. The dot clock can be switched at build
-// time between 29MHZ and 27MHZ (See c64_clock_finder.c)
+#ifdef SIM_CLK_DVI
+// For efinix, clk_dvi is slower than dot4x by the right fraction (13/16
+// for NTSC and 15/16 for PAL) and we chop off some of the border area.
+// For spartan, the full resolution is used so clk_dot4x = clk_dvi.
+// These are clk_dvi edges per 16 dot4x edges. The dot clock can be
+// switched at build time between 29MHZ and 27MHZ (See c64_clock_finder.c)
 #ifdef PAL_32MHZ
-static int tick_scale_pal[] = {1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1};
+#define DVI_EDGES_PAL 16
 #endif
 #ifdef PAL_15MHZ
-static int tick_scale_pal[] = {1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0};
+#define DVI_EDGES_PAL 8
 #endif
 #ifdef PAL_29MHZ
-static int tick_scale_pal[] = {1,1,1,1,1,1,1,0,1,1,1,1,1,1,1,1};
+#define DVI_EDGES_PAL 15
 #endif
 #ifdef PAL_27MHZ
-static int tick_scale_pal[] = {1,1,1,1,1,0,1,1,1,1,1,0,1,1,1,1};
+#define DVI_EDGES_PAL 14
 #endif
 
 #ifdef NTSC_32MHZ
-static int tick_scale_ntsc[] = {1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1};
+#define DVI_EDGES_NTSC 16
 #endif
 #ifdef NTSC_16MHZ
-static int tick_scale_ntsc[] = {1,0,1,0,1,0,1,0,1,0,1,0,1,0,1,0};
+#define DVI_EDGES_NTSC 8
 #endif
 #ifdef NTSC_26MHZ
-static int tick_scale_ntsc[] = {1,1,1,0,1,1,1,1,0,1,1,1,0,1,1,1};
+#define DVI_EDGES_NTSC 13
+#endif
 #endif
 
+static struct clock_sched sched;
+static int clkDot4x;
+#ifdef SIM_CLK_COL16X
+static int clkCol16x;
 #endif
+#ifdef SIM_CLK_DVI
+static int clkDvi;
 #endif
 
-double col16xtick = 0;
+static void clocks_init(int chip) {
+   uint64_t colDen = (chip & 1) ? COL16X_PER_4_DOT4X_PAL :
+                                  COL16X_PER_4_DOT4X_NTSC;
+   uint64_t dviEdges = 1;
+#ifdef SIM_CLK_DVI
+   dviEdges = (chip & 1) ? DVI_EDGES_PAL : DVI_EDGES_NTSC;
+#endif
 
-static vluint64_t nextTick(Vtop* top, VerilatedVcdC* tfp, int chip) {
-   vluint64_t diff1 = nextClk - ticks;
+   // Smallest dot4x half period (in base units) that makes every
+   // other clock's half period a whole number too.
+   uint64_t dotUnits = colDen * dviEdges;
 
-   nextClk += half4XDotPS;
+   cs_init(&sched, half4XDotPS, dotUnits);
+   clkDot4x = cs_add(&sched, dotUnits);
+#ifdef SIM_CLK_COL16X
+   clkCol16x = cs_add(&sched, 4 * dviEdges);
+#endif
+#ifdef SIM_CLK_DVI
+   clkDvi = cs_add(&sched, colDen * 16);
+#endif
+}
 
-   top->V_DOT4X = ~top->V_DOT4X;
-   
-#ifdef EFINIX
-#ifdef WITH_DVI
-   // Emulate our dvi clock in the correct fraction of the dot4x clock
-   if (chip & 1) {
-      if (tick_scale_pal[tc])
-         top->V_CLK_DVI = ~top->V_CLK_DVI;
-   } else {
-      if (tick_scale_ntsc[tc])
-         top->V_CLK_DVI = ~top->V_CLK_DVI;
-   }
+// Evaluations in the run loop go through here so --bench can count
+// them and --profile time them.
+static inline void eval_model(Vtop* top) {
+   uint64_t t = prof_begin();
+   top->eval();
+   prof.evals++;
+   prof_end(PROF_EVAL, t);
+}
 
-   tc++;
-   if (tc>=16) tc=0;
+// Advance to the next dot4x edge. Edges of other clocks before it are
+// evaluated one timestamp at a time. Coincident edges share one eval.
+//
+// The dot4x edge itself is only evaluated when evalEdge is set. Callers
+// that eval before changing any inputs can leave it off and let their
+// own eval cover the edge.
+static vluint64_t nextTick(Vtop* top, bool evalEdge) {
+   while (true) {
+      unsigned int edges = cs_next(&sched);
+#ifdef SIM_CLK_COL16X
+      if (edges & (1 << clkCol16x))
+         top->V_COL16X = ~top->V_COL16X;
 #endif
+#ifdef SIM_CLK_DVI
+      if (edges & (1 << clkDvi))
+         top->V_CLK_DVI = ~top->V_CLK_DVI;
 #endif
+      if (edges & (1 << clkDot4x))
+         break;
 
-   top->V_COL4X = ~top->V_COL4X;
+      eval_model(top);
+#if VM_TRACE
+      if (tfp) {
+         uint64_t t = prof_begin();
+         trace_dump(cs_ps(&sched));
+         prof_end(PROF_TRACE, t);
+      }
+#endif
+   }
 
-   // One tick of dot4x 
-   // = 9/4 ticks of col16x for PAL, 7/4 ticks of col16x for NTSC
+   top->V_DOT4X = ~top->V_DOT4X;
+   dot4xTicks++;
+   if (evalEdge)
+      eval_model(top);
+
+   nextClkCnt = (nextClkCnt + 1) % 32;
+   return cs_ps(&sched);
+}
+
+#if SIM_SAVABLE
+// Snapshots hold the harness clock state followed by the model itself
+// (Verilator --savable). They are only good for the same build and chip.
+#define SNAPSHOT_MAGIC   0x4b534e50 // 'KSNP'
+#define SNAPSHOT_VERSION 2
+
+struct sim_snapshot {
+   uint32_t magic;
+   uint32_t version;
+   uint32_t chip;
+   uint32_t modelSize;
+   vluint64_t ticks;
+   struct clock_sched sched;
+   int32_t nextClkCnt;
+   int32_t frame;
+   unsigned char prev_signal_values[NUM_SIGNALS];
+};
 
-   if (chip & 1) {
-       col16xtick += 9.0f/4.0d;
-   } else {
-       col16xtick += 7.0f/4.0d;
+// Return 1 on error, 0 success
+static int save_snapshot(const char* filename, Vtop* top, int chip, int frame) {
+   struct sim_snapshot snap;
+   memset(&snap, 0, sizeof(snap));
+   snap.magic = SNAPSHOT_MAGIC;
+   snap.version = SNAPSHOT_VERSION;
+   snap.chip = chip;
+   snap.modelSize = sizeof(Vtop);
+   snap.ticks = ticks;
+   snap.sched = sched;
+   snap.nextClkCnt = nextClkCnt;
+   snap.frame = frame;
+   memcpy(snap.prev_signal_values, prev_signal_values, NUM_SIGNALS);
+
+   VerilatedSave os;
+   os.open(filename);
+   if (!os.isOpen()) {
+      LOG(LOG_ERROR, "can't write snapshot %s", filename);
+      return 1;
    }
+   os.write(&snap, sizeof(snap));
+   os << *top;
+   os.close();
+   return 0;
+}
 
-   next16XColClk = nextClk;
-   while (col16xtick >= 1) {
-       top->V_COL16X = ~top->V_COL16X;
-       top->eval();
-#if VM_TRACE
-       if (tfp) tfp->dump(next16XColClk / TICKS_TO_TIMESCALE);
-#endif
-       next16XColClk += half16XColPS;
-       col16xtick -= 1;
+// Return 1 on error, 0 success. frame receives the frame the snapshot
+// was taken at.
+static int restore_snapshot(const char* filename, Vtop* top, int chip,
+                            int* frame) {
+   struct sim_snapshot snap;
+
+   VerilatedRestore os;
+   os.open(filename);
+   if (!os.isOpen()) {
+      LOG(LOG_ERROR, "can't read snapshot %s", filename);
+      return 1;
+   }
+   os.read(&snap, sizeof(snap));
+   if (snap.magic != SNAPSHOT_MAGIC || snap.version != SNAPSHOT_VERSION ||
+          snap.modelSize != sizeof(Vtop)) {
+      LOG(LOG_ERROR, "%s is not a snapshot from this build", filename);
+      os.close();
+      return 1;
    }
+   if (snap.chip != (uint32_t) chip) {
+      LOG(LOG_ERROR, "%s was taken with chip %d", filename, snap.chip);
+      os.close();
+      return 1;
+   }
+   os >> *top;
+   os.close();
+
+   ticks = snap.ticks;
+   sched = snap.sched;
+   nextClkCnt = snap.nextClkCnt;
+   *frame = snap.frame;
+   memcpy(prev_signal_values, snap.prev_signal_values, NUM_SIGNALS);
+   return 0;
+}
+#endif
 
-   nextClkCnt = (nextClkCnt + 1) % 32;
-   return ticks + diff1;
+static void drawPixel(struct framebuf* fb, int x, int y, uint32_t color) {
+   fb_plot(fb, x, y*2, color);
+   fb_plot(fb, x, y*2+1, color);
 }
 
-static void drawPixel(SDL_Renderer* ren, int x,int y) {
-   SDL_RenderDrawPoint(ren, x,y*2);
-   SDL_RenderDrawPoint(ren, x,y*2+1);
+// Apply one of VICE's registers to the model
+static void reg_vice_to_fpga(Vtop* top, struct vicii_state* state, int reg) {
+       unsigned char val = state->vice_reg[reg];
+       int n;
+
+       if (reg < 0x10) {
+          n = reg >> 1;
+          if (reg & 1)
+             top->V_SPRITE_Y[n] = val;
+          else
+             top->V_SPRITE_X[n] = val | (((state->vice_reg[0x10] >> n) & 1) << 8);
+          return;
+       }
+
+       if (reg >= 0x27 && reg <= 0x2e) {
+          top->V_SPRITE_COL[reg - 0x27] = val;
+          return;
+       }
+
+       switch (reg) {
+          case 0x10:
+             for (n = 0; n < 8; n++)
+                top->V_SPRITE_X[n] = state->vice_reg[n * 2] | (((val >> n) & 1) << 8);
+             break;
+          case 0x11:
+             top->V_YSCROLL = val & 7;
+             top->V_RSEL = val & 8 ? 1 : 0;
+             top->V_DEN = val & 16 ? 1 : 0;
+             top->V_BMM = val & 32 ? 1 : 0;
+             top->V_ECM = val & 64 ? 1 : 0;
+             // fall through - bit 8 of the raster compare lives here
+          case 0x12:
+             top->V_RASTERCMP = state->vice_reg[0x12] |
+                                ((state->vice_reg[0x11] & 128) << 1);
+             top->V_RASTERCMP_D = top->V_RASTERCMP;
+             break;
+          case 0x13:
+             top->V_LPX = val;
+             break;
+          case 0x14:
+             top->V_LPY = val;
+             break;
+          case 0x15:
+             top->V_SPRITE_EN = val;
+             break;
+          case 0x16:
+             top->V_XSCROLL = val & 7;
+             top->V_CSEL = val & 8 ? 1 : 0;
+             top->V_MCM = val & 16 ? 1 : 0;
+             top->V_RES = val & 32 ? 1 : 0;
+             break;
+          case 0x17:
+             top->V_SPRITE_YE = val;
+             break;
+          case 0x18:
+             top->V_CB = (val & 14) >> 1;
+             top->V_VM = (val & 240) >> 4;
+             break;
+          case 0x1A:
+             top->V_ERST = val & 1;
+             top->V_EMBC = val & 2 ? 1 : 0;
+             top->V_EMMC = val & 4 ? 1 : 0;
+             top->V_ELP = val & 8 ? 1 : 0;
+             break;
+          case 0x1b:
+             top->V_SPRITE_PRI = val;
+             break;
+          case 0x1c:
+             top->V_SPRITE_MMC = val;
+             break;
+          case 0x1d:
+             top->V_SPRITE_XE = val;
+             break;
+          case 0x1e:
+             top->V_SPRITE_M2M = val;
+             if (val != 0) top->V_M2M_TRIGGERED = 1;
+             break;
+          case 0x1f:
+             top->V_SPRITE_M2D = val;
+             if (val != 0) top->V_M2D_TRIGGERED = 1;
+             break;
+          case 0x20:
+             top->V_EC = val & 15 | 0x11110000;
+             break;
+          case 0x21:
+             top->V_B0C = val & 15 | 0x11110000;
+             break;
+          case 0x22:
+             top->V_B1C = val & 15 | 0x11110000;
+             break;
+          case 0x23:
+             top->V_B2C = val & 15 | 0b11110000;
+             break;
+          case 0x24:
+             top->V_B3C = val & 15 | 0b11110000;
+             break;
+          case 0x25:
+             top->V_SPRITE_MC0 = val;
+             break;
+          case 0x26:
+             top->V_SPRITE_MC1 = val;
+             break;
+          default:
+             // 0x19 interrupt latches come over in the irq fields
+             break;
+       }
 }
 
-// Initial sync
+// Initial sync. Only registers and field groups VICE marked dirty
+// are applied.
 static void regs_vice_to_fpga(Vtop* top, struct vicii_state* state) {
-       top->V_IDLE = state->idle;
-
-       // Sync registers
-       unsigned char val = state->vice_reg[0x11];
-       top->V_YSCROLL = val & 7;
-       top->V_RSEL = val & 8 ? 1 : 0;
-       top->V_DEN = val & 16 ? 1 : 0;
-       top->V_BMM = val & 32 ? 1 : 0;
-       top->V_ECM = val & 64 ? 1 : 0;
-       int rasterCmp8 = (val & 128) << 1;
-
-       val = state->vice_reg[0x12];
-       top->V_RASTERCMP = val | rasterCmp8;
-       top->V_RASTERCMP_D = val | rasterCmp8;
-
-       top->V_LPX = state->vice_reg[0x13];
-       top->V_LPY = state->vice_reg[0x14];
-
-       val = state->vice_reg[0x16];
-       top->V_XSCROLL = val & 7;
-       top->V_CSEL = val & 8 ? 1 : 0;
-       top->V_MCM = val & 16 ? 1 : 0;
-       top->V_RES = val & 32 ? 1 : 0;
-
-       val = state->vice_reg[0x18];
-       top->V_CB = (val & 14) >> 1;
-       top->V_VM = (val & 240) >> 4;
-
-       val = state->vice_reg[0x19];
-       //top->V_IRST_CLR = val & 1;
-       //top->V_IMBC_CLR = val & 2 ? 1 : 0;
-       //top->V_IMMC_CLR = val & 4 ? 1 : 0;
-       //top->V_ILP_CLR =  val & 8 ? 1 : 0;
-
-       val = state->vice_reg[0x1A];
-       top->V_ERST = val & 1;
-       top->V_EMBC = val & 2 ? 1 : 0;
-       top->V_EMMC = val & 4 ? 1 : 0;
-       top->V_ELP = val & 8 ? 1 : 0;
-
-       val = state->vice_reg[0x20];
-       top->V_EC = val & 15 | 0x11110000;
-       val = state->vice_reg[0x21];
-       top->V_B0C = val & 15 | 0x11110000;
-       val = state->vice_reg[0x22];
-       top->V_B1C = val & 15 | 0x11110000;
-       val = state->vice_reg[0x23];
-       top->V_B2C = val & 15 | 0b11110000;
-       val = state->vice_reg[0x24];
-       top->V_B3C = val & 15 | 0b11110000;
-
-       top->V_VC = state->vc;
-       top->V_RC = state->rc;
-       top->V_VCBASE = state->vc_base;
-
-       top->V_ALLOW_BAD_LINES = state->allow_bad_lines;
-       top->V_REG11_DELAYED = state->reg11_delayed;
-
-       top->V_SPRITE_X[0] = state->vice_reg[0x00] | ((state->vice_reg[0x10] & 1) << 8);
-       top->V_SPRITE_Y[0] = state->vice_reg[0x01];
-       top->V_SPRITE_X[1] = state->vice_reg[0x02] | ((state->vice_reg[0x10] & 2) << 7);
-       top->V_SPRITE_Y[1] = state->vice_reg[0x03];
-       top->V_SPRITE_X[2] = state->vice_reg[0x04] | ((state->vice_reg[0x10] & 4) << 6);
-       top->V_SPRITE_Y[2] = state->vice_reg[0x05];
-       top->V_SPRITE_X[3] = state->vice_reg[0x06] | ((state->vice_reg[0x10] & 8) << 5);
-       top->V_SPRITE_Y[3] = state->vice_reg[0x07];
-       top->V_SPRITE_X[4] = state->vice_reg[0x08] | ((state->vice_reg[0x10] & 16) << 4);
-       top->V_SPRITE_Y[4] = state->vice_reg[0x09];
-       top->V_SPRITE_X[5] = state->vice_reg[0x0a] | ((state->vice_reg[0x10] & 32) << 3);
-       top->V_SPRITE_Y[5] = state->vice_reg[0x0b];
-       top->V_SPRITE_X[6] = state->vice_reg[0x0c] | ((state->vice_reg[0x10] & 64) << 2);
-       top->V_SPRITE_Y[6] = state->vice_reg[0x0d];
-       top->V_SPRITE_X[7] = state->vice_reg[0x0e] | ((state->vice_reg[0x10] & 128) << 1);
-       top->V_SPRITE_Y[7] = state->vice_reg[0x0f];
-
-       top->V_SPRITE_EN = state->vice_reg[0x15];
-       top->V_SPRITE_YE = state->vice_reg[0x17];
-       top->V_SPRITE_PRI = state->vice_reg[0x1b];
-       top->V_SPRITE_MMC = state->vice_reg[0x1c];
-       top->V_SPRITE_XE = state->vice_reg[0x1d];
-
-       top->V_SPRITE_M2M = state->vice_reg[0x1e];
-       top->V_SPRITE_M2D = state->vice_reg[0x1f];
-
-       top->V_SPRITE_MC0 = state->vice_reg[0x25];
-       top->V_SPRITE_MC1 = state->vice_reg[0x26];
-
-       top->V_SPRITE_DMA = 0;
-       for (int n=0, b=1;n<8;n++,b=b*2) {
-          top->V_SPRITE_MC[n] = state->mc[n];
-          top->V_SPRITE_MCBASE[n] = state->mcbase[n];
-          top->V_SPRITE_YE_FF[n] = state->ye_ff[n];
-	  top->V_SPRITE_DMA |= state->sprite_dma[n] ? b : 0;
-          top->V_SPRITE_COL[n] = state->vice_reg[0x27+n];
+       unsigned int dirty = state->vice_dirty;
+       unsigned long long regDirty = state->vice_reg_dirty;
+
+       // VICE isn't tracking changes so take everything
+       if (dirty == 0 && regDirty == 0) {
+          dirty = VICII_DIRTY_ALL;
+          regDirty = ~0ULL;
+       }
+
+       while (regDirty) {
+          int reg = __builtin_ctzll(regDirty);
+          regDirty &= regDirty - 1;
+          if (reg < 0x2f)
+             reg_vice_to_fpga(top, state, reg);
        }
 
-       top->V_RASTER_IRQ_TRIGGERED = state->raster_irq_triggered;
-       top->V_IRST = state->irst;
-       top->V_IMBC = state->imbc;
-       if (state->vice_reg[0x1f] != 0) top->V_M2D_TRIGGERED = 1;
-       top->V_IMMC = state->immc;
-       if (state->vice_reg[0x1e] != 0) top->V_M2M_TRIGGERED = 1;
-       top->V_ILP = state->ilp;
+       if (dirty & VICII_DIRTY_FLAGS) {
+          top->V_IDLE = state->idle;
+          top->V_ALLOW_BAD_LINES = state->allow_bad_lines;
+          top->V_REG11_DELAYED = state->reg11_delayed;
+
+          top->V_RASTER_IRQ_TRIGGERED = state->raster_irq_triggered;
+          top->V_IRST = state->irst;
+          top->V_IMBC = state->imbc;
+          top->V_IMMC = state->immc;
+          top->V_ILP = state->ilp;
+
+          top->V_VBORDER = state->vborder;
+          top->V_MAIN_BORDER = state->main_border;
+          top->V_SET_VBORDER = state->set_vborder;
+
+          top->V_LIGHTPEN_TRIGGERED = state->light_pen_triggered;
+       }
 
-       top->V_VBORDER = state->vborder;
-       top->V_MAIN_BORDER = state->main_border;
-       top->V_SET_VBORDER = state->set_vborder;
+       if (dirty & VICII_DIRTY_COUNTERS) {
+          top->V_VC = state->vc;
+          top->V_RC = state->rc;
+          top->V_VCBASE = state->vc_base;
+       }
 
-       top->V_LIGHTPEN_TRIGGERED = state->light_pen_triggered;
+       if (dirty & VICII_DIRTY_SPRITES) {
+          top->V_SPRITE_DMA = 0;
+          for (int n=0, b=1;n<8;n++,b=b*2) {
+             top->V_SPRITE_MC[n] = state->mc[n];
+             top->V_SPRITE_MCBASE[n] = state->mcbase[n];
+             top->V_SPRITE_YE_FF[n] = state->ye_ff[n];
+             top->V_SPRITE_DMA |= state->sprite_dma[n] ? b : 0;
+          }
+       }
 
        // We need to populate our char buf from VICE's
-       for (int i=0;i < 40; i++) {
-           top->V_CHAR_BUF[i] = state->char_buf[i] | (state->color_buf[i] << 8);
+       if (dirty & VICII_DIRTY_CHAR_BUF) {
+          for (int i=0;i < 40; i++) {
+              top->V_CHAR_BUF[i] = state->char_buf[i] | (state->color_buf[i] << 8);
+          }
        }
+
+       state->vice_dirty = 0;
+       state->vice_reg_dirty = 0;
 }
 
+// Step forward until we get to the target cycle/line and phi high,
+// then to where dot4x just ticked low (we always tick into high
+// when beginning to step so we must leave dot4x low). We
+// don't have to worry about going over the last xpos or
+// the repeats on the R8 because the VICE sync won't attempt
+// a sync past xpos 0x17c. Then load state into the model.
+static void sync_to_state(Vtop* top, struct vicii_state* state) {
+       while (true) {
+          top->eval();
+
+          if (top->V_CYCLE_NUM == state->cycle_num &&
+                  top->V_RASTER_LINE == state->raster_line &&
+                  top->clk_phi) break;
+
+#if VM_TRACE
+          trace_dump(ticks);
+#endif
+          ticks = nextTick(top, true);
+          STATE(top);
+          STORE_PREV();
+       }
+
+       // Now 3 more ticks + 1 more from leaving this block
+       // and we will land one 'step' into our target cycle.
+       for (int i=0; i< 3; i++) {
+          top->eval();
+#if VM_TRACE
+          trace_dump(ticks);
+#endif
+          ticks = nextTick(top, true);
+          STATE(top);
+          STORE_PREV();
+       }
+
+       regs_vice_to_fpga(top, state);
+
+       // phi went high on a dot4x rising edge and three more edges leave
+       // dot4x low, still early in the high phase (a phase is 32 edges).
+       // Our next tick brings dot4x high.
+       CHECK(top, CHK_SYNC_PHI, top->clk_phi && !top->V_DOT4X);
+
+       LOG(LOG_INFO, "synced FPGA to cycle=%u, raster_line=%u, xpos=%03x, bmm=%d, mcm=%d, ecm=%d",
+          state->cycle_num, state->raster_line, state->xpos, top->V_BMM, top->V_MCM, top->V_ECM);
+}
+
+// Only touch the shared page when a value actually changed and tell
+// VICE about it through the dirty masks.
+#define PUT_REG(reg, v) do { \
+          unsigned char _v = (v); \
+          if (state->fpga_reg[reg] != _v) { \
+             state->fpga_reg[reg] = _v; \
+             state->fpga_reg_dirty |= 1ULL << (reg); \
+          } \
+       } while (0)
+
+#define PUT_FIELD(field, v, group) do { \
+          unsigned int _v = (v); \
+          if ((field) != _v) { \
+             (field) = _v; \
+             state->fpga_dirty |= (group); \
+          } \
+       } while (0)
+
 static void regs_fpga_to_vice(Vtop* top, struct vicii_state* state) {
-       state->fpga_reg[0x11] =
+       PUT_REG(0x11,
           (top->V_YSCROLL & 0x7) |
           (top->V_RSEL ? 8 : 0) |
           (top->V_DEN  ? 16 : 0) |
           (top->V_BMM  ? 32 : 0) |
           (top->V_ECM  ? 64 : 0) |
-          ((top->V_RASTER_LINE_D & 256) ? 128 : 0);
+          ((top->V_RASTER_LINE_D & 256) ? 128 : 0));
 
-       state->fpga_reg[0x12] =
-          top->V_RASTER_LINE_D & 0xff;
+       PUT_REG(0x12,
+          top->V_RASTER_LINE_D & 0xff);
 
-       state->fpga_reg[0x13] = top->V_LPX;
-       state->fpga_reg[0x14] = top->V_LPY;
+       PUT_REG(0x13, top->V_LPX);
+       PUT_REG(0x14, top->V_LPY);
 
-       state->fpga_reg[0x16] =
+       PUT_REG(0x16,
           (top->V_XSCROLL & 0x7) |
           (top->V_CSEL ? 8 : 0) |
           (top->V_MCM ? 16 : 0) |
           (top->V_RES ? 32 : 0) |
-          0b11000000;
+          0b11000000);
 
-       state->fpga_reg[0x18] = 1 |
+       PUT_REG(0x18, 1 |
           ((top->V_CB & 0x7) << 1) |
-          ((top->V_VM & 0xf) << 4);
+          ((top->V_VM & 0xf) << 4));
 
-       state->fpga_reg[0x19] =
+       PUT_REG(0x19,
 	  (top->V_IRQ ? 128 : 0) |
           (top->V_IRST ? 1 : 0) |
           (top->V_IMBC ? 2 : 0) |
           (top->V_IMMC ? 4 : 0) |
           (top->V_ILP ? 8 : 0) |
-          0b01110000;
+          0b01110000);
 
-       state->fpga_reg[0x1A] =
+       PUT_REG(0x1A,
           (top->V_ERST  ? 1 : 0) |
           (top->V_EMBC  ? 2 : 0) |
           (top->V_EMMC  ? 4 : 0) |
           (top->V_ELP   ? 8 : 0) |
-          0b11110000;
-
-       state->fpga_reg[0x20] =
-          (top->V_EC & 15) | 0b11110000;
-       state->fpga_reg[0x21] =
-          (top->V_B0C & 15) | 0b11110000;
-       state->fpga_reg[0x22] =
-          (top->V_B1C & 15) | 0b11110000;
-       state->fpga_reg[0x23] =
-          (top->V_B2C & 15) | 0b11110000;
-       state->fpga_reg[0x24] =
-          (top->V_B3C & 15) | 0b11110000;
-
-       state->vc = top->V_VC;
-       state->vc_base = top->V_VCBASE;
-       state->rc = top->V_RC;
-
-       state->allow_bad_lines = top->V_ALLOW_BAD_LINES;
-       state->reg11_delayed = top->V_REG11_DELAYED;
-
-       state->fpga_reg[0x00] = top->V_SPRITE_X[0] & 0xff;
-       state->fpga_reg[0x01] = top->V_SPRITE_Y[0];
-       state->fpga_reg[0x02] = top->V_SPRITE_X[1] & 0xff;
-       state->fpga_reg[0x03] = top->V_SPRITE_Y[1];
-       state->fpga_reg[0x04] = top->V_SPRITE_X[2] & 0xff;
-       state->fpga_reg[0x05] = top->V_SPRITE_Y[2];
-       state->fpga_reg[0x06] = top->V_SPRITE_X[3] & 0xff;
-       state->fpga_reg[0x07] = top->V_SPRITE_Y[3];
-       state->fpga_reg[0x08] = top->V_SPRITE_X[4] & 0xff;
-       state->fpga_reg[0x09] = top->V_SPRITE_Y[4];
-       state->fpga_reg[0x0a] = top->V_SPRITE_X[5] & 0xff;
-       state->fpga_reg[0x0b] = top->V_SPRITE_Y[5];
-       state->fpga_reg[0x0c] = top->V_SPRITE_X[6] & 0xff;
-       state->fpga_reg[0x0d] = top->V_SPRITE_Y[6];
-       state->fpga_reg[0x0e] = top->V_SPRITE_X[7] & 0xff;
-       state->fpga_reg[0x0f] = top->V_SPRITE_Y[7];
-       state->fpga_reg[0x10] = ((top->V_SPRITE_X[0] & 256) >> 8) |
-                               ((top->V_SPRITE_X[1] & 256) >> 7) |
-                               ((top->V_SPRITE_X[2] & 256) >> 6) |
-                               ((top->V_SPRITE_X[3] & 256) >> 5) |
-                               ((top->V_SPRITE_X[4] & 256) >> 4) |
-                               ((top->V_SPRITE_X[5] & 256) >> 3) |
-                               ((top->V_SPRITE_X[6] & 256) >> 2) |
-                               ((top->V_SPRITE_X[7] & 256) >> 1);
-
-       state->fpga_reg[0x15] = top->V_SPRITE_EN;
-       state->fpga_reg[0x17] = top->V_SPRITE_YE;
-       state->fpga_reg[0x1b] = top->V_SPRITE_PRI;
-       state->fpga_reg[0x1c] = top->V_SPRITE_MMC;
-       state->fpga_reg[0x1d] = top->V_SPRITE_XE;
-       state->fpga_reg[0x1e] = top->V_SPRITE_M2M;
-       state->fpga_reg[0x1f] = top->V_SPRITE_M2D;
-       state->fpga_reg[0x25] = top->V_SPRITE_MC0 | 0xf0;
-       state->fpga_reg[0x26] = top->V_SPRITE_MC1 | 0xf0;
+          0b11110000);
+
+       PUT_REG(0x20,
+          (top->V_EC & 15) | 0b11110000);
+       PUT_REG(0x21,
+          (top->V_B0C & 15) | 0b11110000);
+       PUT_REG(0x22,
+          (top->V_B1C & 15) | 0b11110000);
+       PUT_REG(0x23,
+          (top->V_B2C & 15) | 0b11110000);
+       PUT_REG(0x24,
+          (top->V_B3C & 15) | 0b11110000);
+
+       PUT_FIELD(state->vc, top->V_VC, VICII_DIRTY_COUNTERS);
+       PUT_FIELD(state->vc_base, top->V_VCBASE, VICII_DIRTY_COUNTERS);
+       PUT_FIELD(state->rc, top->V_RC, VICII_DIRTY_COUNTERS);
+
+       PUT_FIELD(state->allow_bad_lines, top->V_ALLOW_BAD_LINES,
+                 VICII_DIRTY_FLAGS);
+       PUT_FIELD(state->reg11_delayed, top->V_REG11_DELAYED,
+                 VICII_DIRTY_FLAGS);
+
+       int msb = 0;
+       for (int n=0;n<8;n++) {
+          PUT_REG(n * 2, top->V_SPRITE_X[n] & 0xff);
+          PUT_REG(n * 2 + 1, top->V_SPRITE_Y[n]);
+          msb |= ((top->V_SPRITE_X[n] & 256) >> 8) << n;
+       }
+       PUT_REG(0x10, msb);
+
+       PUT_REG(0x15, top->V_SPRITE_EN);
+       PUT_REG(0x17, top->V_SPRITE_YE);
+       PUT_REG(0x1b, top->V_SPRITE_PRI);
+       PUT_REG(0x1c, top->V_SPRITE_MMC);
+       PUT_REG(0x1d, top->V_SPRITE_XE);
+       PUT_REG(0x1e, top->V_SPRITE_M2M);
+       PUT_REG(0x1f, top->V_SPRITE_M2D);
+       PUT_REG(0x25, top->V_SPRITE_MC0 | 0xf0);
+       PUT_REG(0x26, top->V_SPRITE_MC1 | 0xf0);
 
        for (int n=0,b=1;n<8;n++,b=b*2) {
-          state->mc[n] = top->V_SPRITE_MC[n];
-          state->mcbase[n] = top->V_SPRITE_MCBASE[n];
-          state->ye_ff[n] = top->V_SPRITE_YE_FF[n];
-          state->sprite_dma[n] = top->V_SPRITE_DMA & b ? 1 : 0;
-          state->fpga_reg[0x27+n] = top->V_SPRITE_COL[n] | 0xf0;
+          PUT_FIELD(state->mc[n], top->V_SPRITE_MC[n], VICII_DIRTY_SPRITES);
+          PUT_FIELD(state->mcbase[n], top->V_SPRITE_MCBASE[n],
+                    VICII_DIRTY_SPRITES);
+          PUT_FIELD(state->ye_ff[n], top->V_SPRITE_YE_FF[n],
+                    VICII_DIRTY_SPRITES);
+          PUT_FIELD(state->sprite_dma[n], top->V_SPRITE_DMA & b ? 1 : 0,
+                    VICII_DIRTY_SPRITES);
+          PUT_REG(0x27+n, top->V_SPRITE_COL[n] | 0xf0);
        }
 
        // Tell VICE what our char buf looks like or comparison
        for (int i=0; i < 40; i++) {
-	  state->fpga_char_buf[i] = top->V_CHAR_BUF[i];
+	  PUT_FIELD(state->fpga_char_buf[i], top->V_CHAR_BUF[i],
+                    VICII_DIRTY_CHAR_BUF);
+       }
+}
+
+
+// Memory images for the standalone bus model (--prg, --mem, ...),
+// loaded in command line order.
+#define LOAD_PRG     0
+#define LOAD_BIN     1
+#define LOAD_COLOR   2
+#define LOAD_CHARROM 3
+
+#define MAX_LOADS 16
+
+struct bus_load {
+  int type;
+  const char* filename;
+  unsigned int addr;
+};
+
+static struct bus_load busLoads[MAX_LOADS];
+static int numBusLoads;
+
+static int add_bus_load(int type, char* arg) {
+  if (numBusLoads == MAX_LOADS) {
+     LOG(LOG_ERROR, "too many memory images");
+     return 1;
+  }
+  struct bus_load* l = &busLoads[numBusLoads++];
+  l->type = type;
+  l->filename = arg;
+  l->addr = 0;
+  if (type == LOAD_BIN) {
+     // file[@addr]
+     char* at = strrchr(arg, '@');
+     if (at) {
+        *at = '\0';
+        l->addr = strtol(at + 1, nullptr, 0);
+     }
+  }
+  return 0;
+}
+
+static int bus_load_all(struct busmodel* bus) {
+  for (int i = 0; i < numBusLoads; i++) {
+     struct bus_load* l = &busLoads[i];
+     int rc = 0;
+     switch (l->type) {
+        case LOAD_PRG:
+           rc = bus_load_prg(bus, l->filename);
+           break;
+        case LOAD_BIN:
+           rc = bus_load_bin(bus, l->filename, l->addr);
+           break;
+        case LOAD_COLOR:
+           rc = bus_load_color(bus, l->filename);
+           break;
+        case LOAD_CHARROM:
+           rc = bus_load_charrom(bus, l->filename);
+           break;
+     }
+     if (rc)
+        return 1;
+  }
+  return 0;
+}
+
+// The address VICE should see for this step. We have to simulate the ROM
+// glitch and keep VICE happy with address comparisons.
+// See addressgen.v for the description of the glitch.
+static uint16_t addr_fpga_to_vice(Vtop* top, struct vicii_state* state) {
+       if (top->V_CYCLE_TYPE == VIC_LG) {
+           if (top->V_BMM_DELAYED != top->V_BMM) {
+              uint16_t from_addr = top->V_VICADDR + state->vice_vbank_phi1;
+              uint16_t to_addr = top->V_VICADDR_NOW + state->vice_vbank_phi1;
+              // This is the same cheat VICE uses. But we implement the glitch
+              // the 'real' way on the actual hardware.  This is just for VICE
+              // sync comparison to keep address match happy.
+              if ((from_addr & 0x7000) != 0x1000 && (to_addr & 0x7000) == 0x1000) {
+                  return (top->V_VICADDR & 0xff) | (top->V_VICADDR_NOW & 0xff00);
+              }
+           }
+       }
+       return top->V_VICADDR;
+}
+
+// Everything VICE reads back after a step. Only needs to happen
+// right before we respond.
+static void state_fpga_to_vice(Vtop* top, struct vicii_state* state,
+                               bool cycleByCycle) {
+       state->irq = top->irq;
+       PUT_FIELD(state->irst, top->V_IRST, VICII_DIRTY_FLAGS);
+       PUT_FIELD(state->immc, top->V_IMMC, VICII_DIRTY_FLAGS);
+       PUT_FIELD(state->imbc, top->V_IMBC, VICII_DIRTY_FLAGS);
+       PUT_FIELD(state->ilp, top->V_ILP, VICII_DIRTY_FLAGS);
+       state->ba = top->ba;
+       state->badline = top->V_BADLINE;
+       state->aec = top->aec;
+       state->phi = top->clk_phi;
+       state->addr_from_sim = addr_fpga_to_vice(top, state);
+
+       state->cycle_num = top->V_CYCLE_NUM;
+       state->xpos = top->V_XPOS;
+       state->raster_line = top->V_RASTER_LINE_D;
+       state->cycleByCycleStepping = cycleByCycle;
+       PUT_FIELD(state->idle, top->V_IDLE, VICII_DIRTY_FLAGS);
+       PUT_FIELD(state->vborder, top->V_VBORDER, VICII_DIRTY_FLAGS);
+       PUT_FIELD(state->main_border, top->V_MAIN_BORDER, VICII_DIRTY_FLAGS);
+       state->pps = top->V_PPS;
+       state->dot4x = top->V_DOT4X ? 1 : 0;
+
+       regs_fpga_to_vice(top, state);
+}
+
+// --record logs every exchange with VICE, --replay plays it back
+// instead of VICE. See stimtrace.h.
+static struct stim_step stimStep;    // exchange in flight
+static bool stimPending;
+static struct vicii_state stimSync;  // the SYNC_STATE that started it
+static bool stimHasSync;
+static struct vicii_state replayState;
+static bool replayFailed;
+
+// Flags a replayed step needs. Batching and syncs are replayed as
+// their own records.
+#define STIM_FLAGS (VICII_OP_CAPTURE_START | VICII_OP_CAPTURE_END | \
+                    VICII_OP_BUS_ACCESS | VICII_OP_CAPTURE_ONE_FRAME)
+
+// Bus inputs of the step that starts now
+static void stim_begin(struct vicii_state* state) {
+       stimStep.addr_to_sim = state->addr_to_sim;
+       stimStep.data_to_sim = state->data_to_sim;
+       stimStep.ce = state->ce;
+       stimStep.rw = state->rw;
+       stimStep.lp = state->lp;
+       stimStep.flags = state->flags & STIM_FLAGS;
+       stimPending = true;
+}
+
+static void stim_write() {
+       if (st_write(stimRec, &stimStep, stimHasSync ? &stimSync : nullptr)) {
+          LOG(LOG_ERROR, "can't write stimulus trace, recording stopped");
+          st_close(stimRec);
+          stimRec = nullptr;
+       }
+       stimHasSync = false;
+       stimPending = false;
+}
+
+// Instead of ipc_receive when replaying. Returns non-zero at the end
+// of the trace.
+static int replay_receive(struct vicii_state* state) {
+       int r = st_read(stimPlay, &stimStep, state);
+       if (r == ST_END)
+          return 1;
+       if (r == ST_ERROR) {
+          replayFailed = true;
+          return 1;
+       }
+
+       state->addr_to_sim = stimStep.addr_to_sim;
+       state->data_to_sim = stimStep.data_to_sim;
+       state->ce = stimStep.ce;
+       state->rw = stimStep.rw;
+       state->lp = stimStep.lp;
+       state->flags = (state->flags & ~(STIM_FLAGS | VICII_OP_BATCH)) |
+                         stimStep.flags;
+       stimPending = true;
+       return 0;
+}
+
+// What VICE would have compared. Returns non-zero on a mismatch.
+static int replay_check(Vtop* top, struct vicii_state* state) {
+       struct stim_step* e = &stimStep;
+       int badReg = -1;
+
+       if (e->hasRegs) {
+          for (int reg = 0; reg < 64 && badReg < 0; reg++)
+             if (state->fpga_reg[reg] != e->regs[reg])
+                badReg = reg;
        }
+
+       if (state->addr_from_sim == e->addr_from_sim &&
+              state->data_from_sim == e->data_from_sim &&
+              state->ba == e->ba && state->aec == e->aec &&
+              state->irq == e->irq && badReg < 0)
+          return 0;
+
+       LOG(LOG_ERROR, "replay mismatch at step %llu (cycle=%d, line=%d)",
+           (unsigned long long) st_steps(stimPlay) - 1,
+           top->V_CYCLE_NUM, top->V_RASTER_LINE);
+       LOG(LOG_ERROR, "   addr %04x/%04x data %03x/%03x ba %d/%d aec %d/%d irq %d/%d",
+           state->addr_from_sim, e->addr_from_sim,
+           state->data_from_sim, e->data_from_sim,
+           state->ba, e->ba, state->aec, e->aec, state->irq, e->irq);
+       if (badReg >= 0)
+          LOG(LOG_ERROR, "   reg $%02x %02x/%02x", badReg,
+              state->fpga_reg[badReg], e->regs[badReg]);
+       replayFailed = true;
+       return 1;
 }
 
+// Instead of ipc_receive_done: record the answer to a lockstep step
+// and hand it to VICE, or check it against the replayed trace.
+static int shadow_done(Vtop* top, struct vicii_ipc* ipc,
+                       struct vicii_state* state) {
+       if (stimPlay)
+          return replay_check(top, state);
+
+       if (stimRec && stimPending) {
+          stimStep.addr_from_sim = state->addr_from_sim;
+          stimStep.data_from_sim = state->data_from_sim;
+          stimStep.ba = state->ba;
+          stimStep.aec = state->aec;
+          stimStep.irq = state->irq;
+          stimStep.hasRegs = 1;
+          memcpy(stimStep.regs, state->fpga_reg, sizeof(stimStep.regs));
+          stim_write();
+       }
+       return ipc_receive_done(ipc);
+}
 
 int main(int argc, char** argv, char** env) {
     SDL_Event event;
     SDL_Renderer* ren = nullptr;
     SDL_Window* win;
+    struct framebuf* fb = nullptr;
 
     struct vicii_state* state;
     bool capture = false;
@@ -617,6 +1425,34 @@ int main(int argc, char** argv, char** env) {
     int  captureByFrameStopXpos = 0;
     int  captureByFrameStopYpos = 0;
     bool showWindow = false;
+    bool headless = false;
+    char *frameOut = nullptr;
+    int frameEvery = 0;
+    int frameNum = 0;
+    int frameFirst = 0;
+    int frameCount = 0;
+    bool framesDone = false;
+    char *streamTarget = nullptr;
+    int ipcKey = -1;
+    int waitFrame = 0;
+    int waitTimeout = 120;
+    char *saveFile = nullptr;
+    char *restoreFile = nullptr;
+    char *ringFile = nullptr;
+    int vicBank = 0;
+    char *vsfFile = nullptr;
+    char *recordFile = nullptr;
+    char *replayFile = nullptr;
+    struct vicii_state vsfState;
+    struct busmodel* bus = nullptr;
+    struct vicii_state pokeState;
+    unsigned long long pokeRegs = 0;
+    memset(&pokeState, 0, sizeof(pokeState));
+    long ringSize = TR_DEFAULT_CAPACITY;
+    int saveFrame = -1;
+    int simFrame = 0;
+    int lastRasterLine = 0;
+    struct framestream* fs = nullptr;
     bool shadowVic = false;
     bool cycleByCycle = false;
     int cycleByCycleCount = 0;
@@ -625,6 +1461,10 @@ int main(int argc, char** argv, char** env) {
     int prevY = -1;
     struct vicii_ipc* ipc;
     bool keyPressToQuit = true;
+    bool bench = false;
+    bool profile = false;
+    double benchEvery = 0;
+    char *benchJson = nullptr;
     bool viceCapture = false;
     bool endCapture = false;
     bool scanline = true;
@@ -635,13 +1475,82 @@ int main(int argc, char** argv, char** env) {
     vluint64_t userDurationUs = -1;
 
     char *cvalue = nullptr;
-    char c;
+    int c;
     char *token;
     regex_t regex;
     int reti, reti2;
     char regex_buf[32];
 
-    while ((c = getopt (argc, argv, "akc:hs:d:wi:zbl:r:gtxqy")) != -1)
+    enum {
+      OPT_HEADLESS = 256,
+      OPT_EVERY,
+      OPT_FRAMES,
+      OPT_STREAM,
+      OPT_IPC_KEY,
+      OPT_WAIT_FRAME,
+      OPT_WAIT_TIMEOUT,
+      OPT_SAVE,
+      OPT_SAVE_FRAME,
+      OPT_RESTORE,
+      OPT_BENCH,
+      OPT_BENCH_EVERY,
+      OPT_BENCH_JSON,
+      OPT_PROFILE,
+      OPT_RING,
+      OPT_RING_SIZE,
+      OPT_CHECK_POLICY,
+      OPT_CHECK_HISTORY,
+      OPT_TRIGGER,
+      OPT_PRE,
+      OPT_POST,
+      OPT_TRACE_DEPTH,
+      OPT_PRG,
+      OPT_MEM,
+      OPT_COLORRAM,
+      OPT_CHARROM,
+      OPT_BANK,
+      OPT_REG,
+      OPT_VSF,
+      OPT_RECORD,
+      OPT_REPLAY,
+    };
+    static struct option long_options[] = {
+      {"headless", no_argument, nullptr, OPT_HEADLESS},
+      {"every", required_argument, nullptr, OPT_EVERY},
+      {"frames", required_argument, nullptr, OPT_FRAMES},
+      {"stream", required_argument, nullptr, OPT_STREAM},
+      {"ipc-key", required_argument, nullptr, OPT_IPC_KEY},
+      {"wait-frame", required_argument, nullptr, OPT_WAIT_FRAME},
+      {"wait-timeout", required_argument, nullptr, OPT_WAIT_TIMEOUT},
+      {"save", required_argument, nullptr, OPT_SAVE},
+      {"save-frame", required_argument, nullptr, OPT_SAVE_FRAME},
+      {"restore", required_argument, nullptr, OPT_RESTORE},
+      {"bench", no_argument, nullptr, OPT_BENCH},
+      {"bench-every", required_argument, nullptr, OPT_BENCH_EVERY},
+      {"bench-json", required_argument, nullptr, OPT_BENCH_JSON},
+      {"profile", no_argument, nullptr, OPT_PROFILE},
+      {"ring", required_argument, nullptr, OPT_RING},
+      {"ring-size", required_argument, nullptr, OPT_RING_SIZE},
+      {"check-policy", required_argument, nullptr, OPT_CHECK_POLICY},
+      {"check-history", required_argument, nullptr, OPT_CHECK_HISTORY},
+      {"trigger", required_argument, nullptr, OPT_TRIGGER},
+      {"pre", required_argument, nullptr, OPT_PRE},
+      {"post", required_argument, nullptr, OPT_POST},
+      {"trace-depth", required_argument, nullptr, OPT_TRACE_DEPTH},
+      {"prg", required_argument, nullptr, OPT_PRG},
+      {"mem", required_argument, nullptr, OPT_MEM},
+      {"colorram", required_argument, nullptr, OPT_COLORRAM},
+      {"charrom", required_argument, nullptr, OPT_CHARROM},
+      {"bank", required_argument, nullptr, OPT_BANK},
+      {"reg", required_argument, nullptr, OPT_REG},
+      {"vsf", required_argument, nullptr, OPT_VSF},
+      {"record", required_argument, nullptr, OPT_RECORD},
+      {"replay", required_argument, nullptr, OPT_REPLAY},
+      {nullptr, 0, nullptr, 0}
+    };
+
+    while ((c = getopt_long (argc, argv, "akc:hs:d:wi:zbl:r:gtxqyo:",
+                             long_options, nullptr)) != -1)
     switch (c) {
       case 'q':
         scanline = false;
@@ -665,6 +1574,123 @@ int main(int argc, char** argv, char** env) {
       case 'w':
         showWindow = true;
         break;
+      case OPT_HEADLESS:
+        headless = true;
+        break;
+      case 'o':
+        frameOut = optarg;
+        break;
+      case OPT_EVERY:
+        frameEvery = atoi(optarg);
+        break;
+      case OPT_FRAMES:
+        if (sscanf(optarg, "%d:%d", &frameFirst, &frameCount) != 2 ||
+               frameFirst < 0 || frameCount < 1) {
+          LOG(LOG_ERROR, "--frames expects K:N");
+          exit(-1);
+        }
+        break;
+      case OPT_STREAM:
+        streamTarget = optarg;
+        break;
+      case OPT_IPC_KEY:
+        ipcKey = atoi(optarg);
+        break;
+      case OPT_WAIT_FRAME:
+        waitFrame = atoi(optarg);
+        break;
+      case OPT_WAIT_TIMEOUT:
+        waitTimeout = atoi(optarg);
+        break;
+      case OPT_SAVE:
+        saveFile = optarg;
+        break;
+      case OPT_SAVE_FRAME:
+        saveFrame = atoi(optarg);
+        break;
+      case OPT_RESTORE:
+        restoreFile = optarg;
+        break;
+      case OPT_BENCH:
+        bench = true;
+        break;
+      case OPT_BENCH_EVERY:
+        benchEvery = atof(optarg);
+        break;
+      case OPT_BENCH_JSON:
+        benchJson = optarg;
+        break;
+      case OPT_PROFILE:
+        profile = true;
+        break;
+      case OPT_RING:
+        ringFile = optarg;
+        break;
+      case OPT_RING_SIZE:
+        ringSize = atol(optarg);
+        break;
+      case OPT_CHECK_POLICY:
+        if (parse_check_policy(optarg))
+          exit(-1);
+        break;
+      case OPT_CHECK_HISTORY:
+        checkHistory = atoi(optarg);
+        break;
+      case OPT_PRG:
+        if (add_bus_load(LOAD_PRG, optarg))
+          exit(-1);
+        break;
+      case OPT_MEM:
+        if (add_bus_load(LOAD_BIN, optarg))
+          exit(-1);
+        break;
+      case OPT_COLORRAM:
+        if (add_bus_load(LOAD_COLOR, optarg))
+          exit(-1);
+        break;
+      case OPT_CHARROM:
+        if (add_bus_load(LOAD_CHARROM, optarg))
+          exit(-1);
+        break;
+      case OPT_BANK:
+        vicBank = atoi(optarg);
+        break;
+      case OPT_VSF:
+        vsfFile = optarg;
+        break;
+      case OPT_RECORD:
+        recordFile = optarg;
+        break;
+      case OPT_REPLAY:
+        replayFile = optarg;
+        break;
+      case OPT_REG: {
+        int reg, val;
+        if (sscanf(optarg, "%i=%i", &reg, &val) != 2 ||
+               reg < 0 || reg > 0x3f) {
+          LOG(LOG_ERROR, "--reg expects R=V");
+          exit(-1);
+        }
+        pokeState.vice_reg[reg] = val;
+        pokeRegs |= 1ULL << reg;
+        break;
+      }
+#if VM_TRACE
+      case OPT_TRIGGER:
+        if (parse_trigger(optarg))
+          exit(-1);
+        tracing = true;
+        break;
+      case OPT_PRE:
+        tracePreTicks = US_TO_TICKS(atol(optarg));
+        break;
+      case OPT_POST:
+        tracePostTicks = US_TO_TICKS(atol(optarg));
+        break;
+      case OPT_TRACE_DEPTH:
+        traceDepth = atoi(optarg);
+        break;
+#endif
       case 'k':
         hideSync = true;
         break;
@@ -682,15 +1708,70 @@ int main(int argc, char** argv, char** env) {
         printf ("  -s [uS]   : start at uS\n");
         printf ("  -d [uS]   : run for uS\n");
         printf ("  -w        : show SDL2 window\n");
+        printf ("  --headless: render into memory only, no SDL video\n");
         printf ("  -z        : single step eval for shadow vic via ipc\n");
         printf ("  -b        : render each cycle, waiting for key press after each one\n");
         printf ("  -c <chip> : 0=CHIP6567R8, 1=CHIP6569R3 2=CHIP6567R56A 3=CHIP6569R1\n");
         printf ("  -l        : log level\n");
         printf ("  -q        : hide scanline\n");
         printf ("  -k        : hide sync lines\n");
-        printf ("  -t        : enable tracing to session.vcd\n");
+        printf ("  -t        : enable tracing to session.fst (.vcd for TRACE=vcd)\n");
+        printf ("  --trace-depth N : trace N levels of hierarchy (default 99)\n");
+        printf ("  --trigger <spec> : only keep a trace window around a trigger.\n");
+        printf ("              line:L[:X] raster line L (at xpos X), reg:A CPU\n");
+        printf ("              write to register A, badline, check (CHECK\n");
+        printf ("              failure). Repeat for any of several. Implies -t\n");
+        printf ("  --pre uS  : history to keep before the trigger (default 100)\n");
+        printf ("  --post uS : trace to keep after the trigger (default 100)\n");
+        printf ("  --prg <file> : without -z, serve VIC fetches from a C64 memory\n");
+        printf ("              model and load a PRG into its RAM. Also:\n");
+        printf ("  --mem <file>[@addr] : raw binary at addr (default 0)\n");
+        printf ("  --colorram <file> : 1K color RAM image\n");
+        printf ("  --charrom <file> : 4K character ROM image\n");
+        printf ("  --bank N  : VIC bank 0-3 (default 0)\n");
+        printf ("  --reg R=V : set VIC register R to V before starting\n");
+        printf ("  --vsf <file> : without -z, start from a VICE x64sc snapshot\n");
+        printf ("              (RAM, color RAM, bank and VIC state). Needs --charrom\n");
+        printf ("  --record <file> : with -z, log VICE's bus stimulus and the\n");
+        printf ("              outputs it accepted\n");
+        printf ("  --replay <file> : run a --record trace without VICE and\n");
+        printf ("              check the outputs (exit status 1 on a mismatch)\n");
         printf ("  -x        : sync with VICE and save a frame before exiting\n");
         printf ("  -y        : save a frame before exiting\n");
+        printf ("  -o <file> : save frames to file (.png or .ppm) at native\n");
+        printf ("              resolution instead of screenshot.bmp\n");
+        printf ("  --every N : also save every Nth frame as file_NNNNN.ext\n");
+        printf ("  --frames K:N : capture frames K..K+N-1 then exit. Frames\n");
+        printf ("              go to --stream or to -o as file_NNNNN.ext\n");
+        printf ("  --stream <target> : stream captured frames to target.y4m,\n");
+        printf ("              a raw RGB file or '|command' (raw RGB pipe)\n");
+        printf ("  --ipc-key <key> : IPC key for -z (default $VICII_IPC_KEY or %d)\n",
+                IPC_DEFAULT_KEY);
+        printf ("  --wait-frame N : with -z, wait until VICE announces frame N\n");
+        printf ("              before starting (start the simulator first).\n");
+        printf ("              If VICE announces nothing, wait N frames of real time\n");
+        printf ("  --wait-timeout S : give up waiting after S seconds (default 120)\n");
+        printf ("  --save <file> : with --save-frame, snapshot the model\n");
+        printf ("  --save-frame N : save a snapshot when frame N begins and exit\n");
+        printf ("  --restore <file> : start from a snapshot instead of reset\n");
+        printf ("  --bench   : report dot4x ticks per second and evals per tick\n");
+        printf ("  --bench-every S : also report every S seconds\n");
+        printf ("  --bench-json <file> : write the --bench report as JSON\n");
+        printf ("  --profile : --bench plus where the time went (eval, render,\n");
+        printf ("              trace, ipc). Timing the phases slows the run\n");
+        printf ("  --ring <file> : record state to a binary trace ring instead\n");
+        printf ("              of the log (print it with tracedump)\n");
+        printf ("  --ring-size N : keep the last N dot4x ticks (default %d)\n",
+                TR_DEFAULT_CAPACITY);
+        printf ("  --check-policy P : what a failed CHECK does: abort, once\n");
+        printf ("              (report the first, count the rest) or count.\n");
+        printf ("              name=P,... sets it per check:\n");
+        printf ("             ");
+        for (int i = 0; i < NUM_CHECKS; i++)
+           printf (" %s", checks[i].name);
+        printf ("\n");
+        printf ("  --check-history N : ring records shown with a failure\n");
+        printf ("              (default %d)\n", checkHistory);
         exit(0);
       case 'x':
 	viceCapture = true;
@@ -711,23 +1792,60 @@ int main(int argc, char** argv, char** env) {
         exit(-1);
     }
 
-    int sdl_init_mode = SDL_INIT_VIDEO;
-    if (SDL_Init(sdl_init_mode) != 0) {
-      LOG(LOG_ERROR, "SDL_Init %s", SDL_GetError());
-      return 1;
+#if SIM_SAVABLE
+    if ((saveFile == nullptr) != (saveFrame < 0)) {
+      LOG(LOG_ERROR, "--save and --save-frame go together");
+      exit(-1);
+    }
+#else
+    if (saveFile || restoreFile) {
+      LOG(LOG_ERROR, "snapshots need a SAVABLE=y build");
+      exit(-1);
+    }
+#endif
+
+    if (recordFile && !shadowVic) {
+      LOG(LOG_ERROR, "--record needs -z");
+      exit(-1);
+    }
+
+    // A replay stands in for VICE. It takes the chip it was recorded with.
+    if (replayFile) {
+      if (shadowVic || numBusLoads || vicBank || vsfFile) {
+        LOG(LOG_ERROR, "--replay can't be used with -z or memory images");
+        exit(-1);
+      }
+      stimPlay = st_open(replayFile);
+      if (stimPlay == nullptr)
+        exit(-1);
+      chip = st_chip(stimPlay);
+      captureByTime = false;
+      shadowVic = true;
+    }
+
+    // Writing frames needs something to render into.
+    if ((frameOut || streamTarget) && !showWindow)
+      headless = true;
+
+    // A window always wins over headless. Either way we render into fb.
+    if (showWindow)
+      headless = false;
+    bool render = showWindow || headless;
+
+    if (showWindow) {
+      int sdl_init_mode = SDL_INIT_VIDEO;
+      if (SDL_Init(sdl_init_mode) != 0) {
+        LOG(LOG_ERROR, "SDL_Init %s", SDL_GetError());
+        return 1;
+      }
     }
 
     // Add new input/output here.
     Vtop* top = new Vtop;
 
 #if VM_TRACE
-    VerilatedVcdC* tfp = NULL;
     if (tracing) {
-        Verilated::traceEverOn(true);  // Verilator must compute traced signals
-        VL_PRINTF("verilog tracing into session.vcd\n");
-        tfp = new VerilatedVcdC;
-        top->trace(tfp, 99);  // Trace 99 levels of hierarchy
-        tfp->open("session.vcd");  // Open the dump file
+        trace_open(top);
     }
 #endif
 
@@ -769,10 +1887,14 @@ int main(int argc, char** argv, char** env) {
 #else
 #ifdef GEN_LUMA_CHROMA
     printf ("Color: Using composite palette/sync\n");
+#else
+#ifdef NATIVE_VIDEO
+    printf ("Color: Using native pixel colors (no sync)\n");
 #else
     printf ("Color: No color information available\n");
 #endif
 #endif
+#endif
 #endif
 
     if (userDurationUs == -1) {
@@ -794,7 +1916,6 @@ int main(int argc, char** argv, char** env) {
 
     if (isNtsc) {
        half4XDotPS = NTSC_HALF_4X_DOT_PS;
-       half16XColPS = NTSC_HALF_16X_COLOR_PS;
        switch (chip) {
           case CHIP6567R56A:
              screenWidth = NTSC_6567R56A_MAX_DOT_X+1;
@@ -814,7 +1935,6 @@ int main(int argc, char** argv, char** env) {
        }
     } else {
        half4XDotPS = PAL_HALF_4X_DOT_PS;
-       half16XColPS = PAL_HALF_16X_COLOR_PS;
        switch (chip) {
           case CHIP6569R1:
           case CHIP6569R3:
@@ -829,7 +1949,45 @@ int main(int argc, char** argv, char** env) {
        }
     }
 
-    nextClk = half4XDotPS;
+    clocks_init(chip);
+
+    if (numBusLoads || vicBank || vsfFile) {
+      if (shadowVic) {
+        LOG(LOG_ERROR, "memory images can't be used with -z");
+        exit(-1);
+      }
+      bus = bus_create();
+      bus_set_bank(bus, vicBank);
+      if (vsfFile) {
+        memset(&vsfState, 0, sizeof(vsfState));
+        if (vsf_load(vsfFile, &vsfState, bus))
+          exit(-1);
+      }
+      // Images on the command line go on top of the snapshot
+      if (bus_load_all(bus))
+        exit(-1);
+    }
+
+    if (ringFile) {
+      if (ringSize < 1) {
+        LOG(LOG_ERROR, "--ring-size must be at least 1");
+        exit(-1);
+      }
+      ring = tr_create(ringFile, ringSize, chip);
+      if (ring == nullptr)
+        return 1;
+      LOG(LOG_INFO, "trace ring %s holds %ld ticks", ringFile, ringSize);
+    }
+
+    if (render) {
+      fb = fb_create(screenWidth*2, screenHeight*2);
+    }
+
+    if (streamTarget) {
+      fs = fs_open(streamTarget, screenWidth, screenHeight, isNtsc ? 60 : 50);
+      if (fs == nullptr)
+        return 1;
+    }
 
     if (showWindow) {
       SDL_DisplayMode current;
@@ -853,6 +2011,13 @@ int main(int argc, char** argv, char** env) {
         SDL_Quit();
         return 1;
       }
+
+      if (fb_attach(fb, ren)) {
+        SDL_DestroyRenderer(ren);
+        SDL_DestroyWindow(win);
+        SDL_Quit();
+        return 1;
+      }
     }
 
     // Default all signals to bit 1 and include in monitoring.
@@ -897,21 +2062,17 @@ int main(int argc, char** argv, char** env) {
        top->eval();
        nextClkCnt = 0;
 #if VM_TRACE
-       if (tfp) tfp->dump(ticks / TICKS_TO_TIMESCALE);
+       trace_dump(ticks);
 #endif
        STATE(top);
        STORE_PREV();
-       ticks = nextTick(top, tfp, chip);
+       ticks = nextTick(top, true);
        cnt++;
     }
 
     // Not sure if this matters anymore
     nextClkCnt = 31;
 
-    // Start counting from after reset
-    startTicks = ticks;
-    endTicks = startTicks + durationTicks;
-
     top->lp = 1;
     top->rw = 1;
     top->ce = 1;
@@ -953,18 +2114,94 @@ int main(int argc, char** argv, char** env) {
     ;
 #endif
 
-    if (shadowVic) {
+#if SIM_SAVABLE
+    // Everything above is overwritten by the snapshot.
+    if (restoreFile) {
+       if (restore_snapshot(restoreFile, top, chip, &simFrame))
+          exit(-1);
+       LOG(LOG_INFO, "restored %s at frame %d", restoreFile, simFrame);
+    }
+#endif
+
+    // Run up to where the snapshot was taken and load it, like a
+    // VICII_OP_SYNC_STATE from VICE.
+    if (vsfFile)
+       sync_to_state(top, &vsfState);
+
+    // Register values from the command line, same path as VICE syncs.
+    for (int reg = 0; reg < 64; reg++) {
+       if (pokeRegs & (1ULL << reg))
+          reg_vice_to_fpga(top, &pokeState, reg);
+    }
+    lastRasterLine = top->V_RASTER_LINE;
+
+    // Start counting from after reset (or the snapshot)
+    startTicks += ticks;
+    endTicks = startTicks + durationTicks;
+
+    // A frame range decides when we stop unless a duration was given.
+    if (frameCount > 0 && userDurationUs == -1)
+       endTicks = (vluint64_t) -1;
+
+    if (stimPlay) {
+       state = &replayState;
+    } else if (shadowVic) {
        ipc = ipc_init(IPC_RECEIVER);
-       ipc_open(ipc);
+       if (ipcKey >= 0)
+          ipc_set_key(ipc, ipcKey);
+       if (ipc_open(ipc)) {
+          LOG(LOG_ERROR, "can't open ipc with key %d", ipc->semsKey);
+          exit(-1);
+       }
+       if (waitFrame > 0) {
+          LOG(LOG_INFO, "waiting for VICE to reach frame %d", waitFrame);
+          if (ipc_wait_frame(ipc, 1, ANNOUNCE_GRACE_S * 1000) == 0) {
+             if (ipc_wait_frame(ipc, waitFrame, waitTimeout * 1000)) {
+                LOG(LOG_ERROR, "VICE did not reach frame %d within %ds",
+                    waitFrame, waitTimeout);
+                ipc_close(ipc);
+                exit(-1);
+             }
+             LOG(LOG_INFO, "VICE ready at frame %d cycle %llu",
+                 ipc->shm->vice_frame, ipc->shm->vice_cycle);
+          } else {
+             // A VICE without the announce hook never moves vice_frame.
+             // Give it as long as the frames take in real time, like
+             // the fixed delay used before, unless it speaks up after all.
+             int fps = isNtsc ? 60 : 50;
+             int rest = waitFrame / fps - ANNOUNCE_GRACE_S;
+             LOG(LOG_WARN, "VICE announced nothing in %ds, waiting %ds more",
+                 ANNOUNCE_GRACE_S, rest > 0 ? rest : 0);
+             if (rest > 0)
+                ipc_wait_frame(ipc, waitFrame, rest * 1000);
+          }
+       }
        state = ipc->state;
+
+       if (recordFile) {
+          stimRec = st_create(recordFile, chip);
+          if (stimRec == nullptr)
+             exit(-1);
+          LOG(LOG_INFO, "recording stimulus to %s", recordFile);
+       }
     }
 
+    struct prof_mark benchStart, benchLast;
+    if (bench || benchEvery > 0 || benchJson || profile)
+       prof_start(profile);
+    prof_mark(&benchStart, dot4xTicks, ticks);
+    benchLast = benchStart;
+
     // IMPORTANT: Any and all state reads/writes MUST occur between ipc_receive
     // and ipc_receive_done inside this loop.
     int ticksUntilDone = 0;
     int ticksUntilPhase = 0;
+    bool inBatch = false;
+    unsigned int batchStep = 0;
+    int batchTicks = 0;
     bool showState = true;
     bool viceCaptureWaitLine1 = true;
+    bool viceCaptureDone = false;
     bool endCaptureWaitLine1 = true;
     while (!Verilated::gotFinish()) {
 
@@ -979,8 +2216,27 @@ int main(int argc, char** argv, char** env) {
 	   }
 
            // Do not change state before this line
-           if (ipc_receive(ipc))
+           uint64_t t = prof_begin();
+           if (stimPlay) {
+              if (replay_receive(state))
+                 break;
+           } else if (ipc_receive(ipc)) {
               break;
+           }
+           prof_end(PROF_IPC, t);
+
+           // Only a chip read during the step sets it again
+           state->data_from_sim = 0;
+
+           if (stimRec) {
+              if (state->flags & VICII_OP_SYNC_STATE) {
+                 stimSync = *state;
+                 stimHasSync = true;
+              }
+              if ((state->flags & VICII_OP_SYNC_STATE) ||
+                     !(state->flags & VICII_OP_BATCH) || ipc->batch->count == 0)
+                 stim_begin(state);
+           }
 
            capture = (state->flags & VICII_OP_CAPTURE_START);
            if (!captureByFrame) {
@@ -991,57 +2247,45 @@ int main(int argc, char** argv, char** env) {
 
            if (state->flags & VICII_OP_SYNC_STATE) {
                state->flags &= ~VICII_OP_SYNC_STATE;
-               // Step forward until we get to the target cycle/line/phase.
-               // rasterline and when dot4x just ticked low (we always tick into high
-               // when beginning to step so we must leave dot4x low. We
-	       // don't have to worry about going over the last xpos or
-	       // the repeats on the R8 because the VICE sync won't attempt
-	       // a sync past xpos 0x17c.
-               while (true) {
-                  top->eval();
-
-		  if (top->V_CYCLE_NUM == state->cycle_num &&
-				  top->V_RASTER_LINE == state->raster_line &&
-				  top->clk_phi) break;
-
-#if VM_TRACE
-	          if (tfp) tfp->dump(ticks / TICKS_TO_TIMESCALE);
-#endif
-                  ticks = nextTick(top, tfp, chip);
-                  STATE(top);
-                  STORE_PREV();
-               }
-
-               // Now 3 more ticks + 1 more from leaving this block
-               // and we will land one 'step' into our target cycle.
-               for (int i=0; i< 3; i++) {
-                  top->eval();
-#if VM_TRACE
-	          if (tfp) tfp->dump(ticks / TICKS_TO_TIMESCALE);
-#endif
-                  ticks = nextTick(top, tfp, chip);
-                  STATE(top);
-                  STORE_PREV();
-               }
-
-	       regs_vice_to_fpga(top, state);
-
-               // Our next tick will bring us high so we should be low right now.
-               CHECK(top, ~top->clk_phi, __LINE__);
-
-               LOG(LOG_INFO, "synced FPGA to cycle=%u, raster_line=%u, xpos=%03x, bmm=%d, mcm=%d, ecm=%d",
-                  state->cycle_num, state->raster_line, state->xpos, top->V_BMM, top->V_MCM, top->V_ECM);
+               sync_to_state(top, state);
 
 	      // Respond to IPC immediately after 1 more tick. This will land us 4 ticks into the
 	      // high phase which is where VICE ipc hook expects us to be.
               ticksUntilDone = 1;
               ticksUntilPhase = 1;
 	      last_phase = 0;
+           } else if ((state->flags & VICII_OP_BATCH) && ipc->batch->count > 0) {
+              // VICE queued a window of steps. Run them all before
+              // responding (or until one doesn't match).
+              if (ipc->batch->count > IPC_BATCH_MAX)
+                 ipc->batch->count = IPC_BATCH_MAX;
+              ipc->batch->done = 0;
+              ipc->batch->mismatch = -1;
+              inBatch = true;
+              batchStep = 0;
+              batchTicks = 0;
+              ticksUntilDone = 4 * ipc->batch->count;
            } else {
               ticksUntilDone = 4;
 	   }
         }
 
+        // Each batch step starts by loading its bus inputs into state
+        // so everything below works the same as lockstep.
+        if (inBatch && batchTicks == 0) {
+           struct vicii_batch_in* in = &ipc->batch->in[batchStep];
+           state->addr_to_sim = in->addr_to_sim;
+           state->data_to_sim = in->data_to_sim;
+           state->ce = in->ce;
+           state->rw = in->rw;
+           state->lp = in->lp;
+           state->flags = (state->flags & ~VICII_OP_BUS_ACCESS) |
+                             (in->flags & VICII_OP_BUS_ACCESS);
+           state->data_from_sim = 0;
+           if (stimRec)
+              stim_begin(state);
+        }
+
         if (shadowVic) {
            // Simulate cs and rw going back high. This is the same
            // timing as what vice hook does when it lowers ce for the
@@ -1059,110 +2303,103 @@ int main(int argc, char** argv, char** env) {
            top->rw = state->rw;
 	   top->lp = state->lp;
 
+        } else if (bus) {
+           // Data the bus model put on the bus at the last CAS. The
+           // edge after it was evaluated with the old data, so the VIC
+           // sees it one dot4x edge later like on the board.
+           top->dbl = bus->data & 0xff;
+           top->dbh = bus->data >> 8;
         }
 
         // Evaluate model
-        top->eval();
+        eval_model(top);
 
         if (shadowVic) {
            if (state->flags & VICII_OP_BUS_ACCESS) {
-              CHECK(top, top->clk_phi, __LINE__);
+              CHECK(top, CHK_BUS_PHI, top->clk_phi);
            }
 	}
 
+        if (bus)
+           bus_clock(bus, top->ras, top->cas, top->ado_sim);
+
+        uint64_t profT = prof_begin();
 #if VM_TRACE
-	if (tfp) tfp->dump(ticks / TICKS_TO_TIMESCALE);
+	trace_dump(ticks);
+	trace_poll(top);
 #endif
 
         if (showState) {
            STATE(top);
         }
+        prof_end(PROF_TRACE, profT);
 
         if (captureByTime)
            capture = (ticks >= startTicks) && (ticks <= endTicks);
 
+        profT = prof_begin();
         if (capture) {
           // On dot clock...
           if (HASCHANGED(OUT_DOT) && RISING(OUT_DOT)) {
              // AEC should always be low in first phase. But AEC is
 	     // slightly delayed so don't check this when bit cycle is 0
              if (top->V_CYCLE_BIT > 0 && top->V_CYCLE_BIT < 4) {
-               CHECK(top, top->aec == 0, __LINE__);
+               CHECK(top, CHK_AEC_LOW, top->aec == 0);
              }
 
              // Make sure xpos is what we expect at key points
              if (top->V_CYCLE_NUM == 12 && top->V_CYCLE_BIT == 4)
-               CHECK (top, top->V_XPOS == 0, __LINE__); // rollover
+               CHECK(top, CHK_XPOS_ROLLOVER, top->V_XPOS == 0);
 
              if (top->V_CYCLE_NUM == 0 && top->V_CYCLE_BIT == 0)
                if (chip == CHIP6569R1 || chip == CHIP6569R3)
-                  CHECK (top, top->V_XPOS == 0x194, __LINE__); // reset
+                  CHECK(top, CHK_XPOS_RESET, top->V_XPOS == 0x194);
                else
-                  CHECK (top, top->V_XPOS == 0x19c, __LINE__); // reset
+                  CHECK(top, CHK_XPOS_RESET, top->V_XPOS == 0x19c);
 
              if (chip == CHIP6567R8)
                if (top->V_CYCLE_NUM == 61 && (top->V_CYCLE_BIT == 0 || top->V_CYCLE_BIT == 4))
-                  CHECK (top, top->V_XPOS == 0x184, __LINE__); // repeat cases
+                  CHECK(top, CHK_XPOS_REPEAT, top->V_XPOS == 0x184);
                else if (top->V_CYCLE_NUM == 62 && top->V_CYCLE_BIT == 0)
-                  CHECK (top, top->V_XPOS == 0x184, __LINE__); // repeat case
-
-             // Refresh counter is supposed to reset at raster 0
-             //if (top->V_RASTER_X == 0 && top->V_RASTER_LINE == 0) TODO Put back
-             //   CHECK (top, top->V_REFC == 0xff, __LINE__);
-
+                  CHECK(top, CHK_XPOS_REPEAT, top->V_XPOS == 0x184);
           }
 
           // If rendering, draw current color on dot clock
 	  // Our simulator resolution is twice that of native so we can
 	  // update every other dot clock tick.
 	  // dot_rising[1] || dot_rising[3]
-          if (showWindow && HASCHANGED(OUT_DOT_RISING) &&
+          if (render && HASCHANGED(OUT_DOT_RISING) &&
 			  (top->V_CLK_DOT == 2 || top->V_CLK_DOT == 8)) {
+            uint32_t color = FB_RGB(0, 0, 0);
 #ifdef GEN_RGB
             // Show h/v sync in red
             if (!hideSync && (!top->hsync || !top->vsync))
-             SDL_SetRenderDrawColor(ren,
-                0b11111111,
-                0b0,
-                0b0,
-                255);
+             color = FB_RGB(0b11111111, 0b0, 0b0);
             else {
              double rr = top->red * 255.0/63.0;
              double gg = top->green * 255.0/63.0;
              double bb = top->blue * 255.0/63.0;
-             SDL_SetRenderDrawColor(ren, rr, gg, bb, 255);
+             color = FB_RGB(rr, gg, bb);
             }
 
             // PURPLE ACTIVE AREA - DEBUGGING
             if (showActive && (top->active))
-             SDL_SetRenderDrawColor(ren,
-                0b11111111,
-                0b0,
-                255,
-                0b0);
+             color = FB_RGB(0b11111111, 0b0, 255);
 #else 
 #ifdef NEED_RGB
             // Show h/v sync in red
             if (!hideSync && (top->HSYNC || top->VSYNC))
-             SDL_SetRenderDrawColor(ren,
-                0b11111111,
-                0b0,
-                0b0,
-                255);
+             color = FB_RGB(0b11111111, 0b0, 0b0);
             else {
              double rr = top->top__DOT__red * 255.0/63.0;
              double gg = top->top__DOT__green * 255.0/63.0;
              double bb = top->top__DOT__blue * 255.0/63.0;
-             SDL_SetRenderDrawColor(ren, rr,gg,bb,255);
+             color = FB_RGB(rr, gg, bb);
             }
 
             // PURPLE ACTIVE AREA - DEBUGGING
             if (showActive && (top->ACTIVE))
-             SDL_SetRenderDrawColor(ren,
-                0b11111111,
-                0b0,
-                255,
-                0b0);
+             color = FB_RGB(0b11111111, 0b0, 255);
 
 #else
 #ifdef GEN_LUMA_CHROMA
@@ -1184,26 +2421,23 @@ int main(int argc, char** argv, char** env) {
 	       int lp2 = top->top__DOT__vic_inst__DOT__lumacode_p2;
 	       int lcff = top->top__DOT__vic_inst__DOT__vic_registers__DOT__lumacode_ff;
                if (lcff == 0 || lcff ==1 )
-               SDL_SetRenderDrawColor(ren,
-                ((lp1*16) << 2) | 0b11,
+               color = FB_RGB(
                 ((lp1*16) << 2) | 0b11,
                 ((lp1*16) << 2) | 0b11,
-                255);
+                ((lp1*16) << 2) | 0b11);
                else {
-               SDL_SetRenderDrawColor(ren,
+               color = FB_RGB(
                 ((lp2*16) << 2) | 0b11,
                 ((lp2*16) << 2) | 0b11,
-                ((lp2*16) << 2) | 0b11,
-                255);
+                ((lp2*16) << 2) | 0b11);
                }
              } else {
 #endif
 	       int index = top->top__DOT__vic_inst__DOT__pixel_color3;
-               SDL_SetRenderDrawColor(ren,
+               color = FB_RGB(
                 (native_rgb[index*3] << 2) | 0b11,
                 (native_rgb[index*3+1] << 2) | 0b11,
-                (native_rgb[index*3+2] << 2) | 0b11,
-                255);
+                (native_rgb[index*3+2] << 2) | 0b11);
 #ifdef LUMACODE
              }
 #endif
@@ -1213,18 +2447,29 @@ int main(int argc, char** argv, char** env) {
 	       if ((top->V_RASTER_X >= hss && top->V_RASTER_X < hse) ||
                       (vsync && top->V_RASTER_LINE != vve && top->V_RASTER_LINE != vvs))
 #ifdef HAVE_LUMA_SINK
-                  SDL_SetRenderDrawColor(ren, 255*top->V_LUMA_SINK,0,0,255);
+                  color = FB_RGB(255*top->V_LUMA_SINK, 0, 0);
 #else
                   // Only for old beta boards
-                  SDL_SetRenderDrawColor(ren, 255,0,0,255);
+                  color = FB_RGB(255, 0, 0);
 #endif
 	       else
-                  SDL_SetRenderDrawColor(ren, 0,0,0,255);
+                  color = FB_RGB(0, 0, 0);
 	    }
 #else
+#ifdef NATIVE_VIDEO
+            // No video encoders at all (fast regression config). The
+            // pixel sequencer's colors are all there is, as with -k,
+            // a raster line late like the RGB output (see top.v).
+            int index = top->native_color;
+            color = FB_RGB(
+             (native_rgb[index*3] << 2) | 0b11,
+             (native_rgb[index*3+1] << 2) | 0b11,
+             (native_rgb[index*3+2] << 2) | 0b11);
+#else
 #warning "There are no video output options available. Simulator will show nothing"
 #endif
 #endif
+#endif
 #endif
              // top->V_CLK_DOT is 2 or 8
 	     int hoffset = top->V_CLK_DOT == 2 ? 0 : 1;
@@ -1249,92 +2494,119 @@ int main(int argc, char** argv, char** env) {
              }
 
              if (1) { //top->top__DOT__vic_inst__DOT__is_native_y) {
-               drawPixel(ren,
+               drawPixel(fb,
                   top->V_RASTER_X*2+hoffset,
-                  rl
+                  rl,
+                  color
                );
              } else {
                // Draw fatter pixels for double y
-               drawPixel(ren,
+               drawPixel(fb,
                   top->V_RASTER_X*4+hoffset*2,
-                  rl
+                  rl,
+                  color
                );
-               drawPixel(ren,
+               drawPixel(fb,
                   top->V_RASTER_X*4+1+hoffset*2,
-                  rl
+                  rl,
+                  color
                );
              }
 
-             // Show updated pixels per raster line
+             // Once per raster line. With the scanline shown, we present
+             // every line so progress is visible. Otherwise the whole
+             // frame is uploaded once when the raster wraps.
              if (prevY != rl) {
+                bool frameDone = rl < prevY;
                 prevY = rl;
 
-                if (scanline) {
+                if (frameDone) {
+                   // Files are numbered from 0 for --every and --frames
+                   // alike, so one number is always the same frame.
+                   int completed = frameNum++;
+                   bool every = frameOut && frameEvery > 0 &&
+                      completed % frameEvery == 0;
+                   if (every)
+                      fd_write_numbered(frameOut, completed, fb,
+                                        screenWidth, screenHeight);
+
+                   bool inRange = completed >= frameFirst &&
+                      (frameCount == 0 || completed < frameFirst + frameCount);
+                   if (inRange && fs)
+                      fs_push(fs, fb);
+                   else if (inRange && frameCount > 0 && frameOut && !every)
+                      fd_write_numbered(frameOut, completed, fb,
+                                        screenWidth, screenHeight);
+
+                   if (frameCount > 0 && completed + 1 >= frameFirst + frameCount)
+                      framesDone = true;
+                }
+
+                if (showWindow && scanline) {
                    for (int xx=0; xx < 504; xx++) {
-                     SDL_SetRenderDrawColor(ren, 255, 255, 255, 255);
-                     drawPixel(ren, xx*2, rl+1);
+                     drawPixel(fb, xx*2, rl+1, FB_RGB(255, 255, 255));
                    }
                 }
 
-                SDL_RenderPresent(ren);
-                SDL_PollEvent(&event);
-                switch (event.type) {
-                   case SDL_QUIT:
-                      state->flags |= VICII_OP_CAPTURE_END;
-                      break;
-                   default:
-                      break;
+                if (showWindow && (scanline || frameDone)) {
+                   fb_present(fb);
+                   SDL_PollEvent(&event);
+                   switch (event.type) {
+                      case SDL_QUIT:
+                         state->flags |= VICII_OP_CAPTURE_END;
+                         break;
+                      default:
+                         break;
+                   }
                 }
              }
           }
         }
-
+        prof_end(PROF_RENDER, profT);
 
         if (shadowVic) {
-           state->irq = top->irq;
-           state->irst = top->V_IRST;
-           state->immc = top->V_IMMC;
-           state->imbc = top->V_IMBC;
-           state->ilp = top->V_ILP;
-           state->ba = top->ba;
-           state->badline = top->V_BADLINE;
-           state->aec = top->aec;
-           state->phi = top->clk_phi;
-	   state->addr_from_sim = top->V_VICADDR;
-
-           // We have to simulate the ROM glitch and keep VICE
-           // happy with address comparisons.
-           // See addressgen.v for the description of the glitch.
-           if (top->V_CYCLE_TYPE == VIC_LG) {
-               if (top->V_BMM_DELAYED != top->V_BMM) {
-                  uint16_t from_addr = top->V_VICADDR + state->vice_vbank_phi1;
-                  uint16_t to_addr = top->V_VICADDR_NOW + state->vice_vbank_phi1;
-                  // This is the same cheat VICE uses. But we implement the glitch
-                  // the 'real' way on the actual hardware.  This is just for VICE
-                  // sync comparison to keep address match happy.
-                  if ((from_addr & 0x7000) != 0x1000 && (to_addr & 0x7000) == 0x1000) {
-                      state->addr_from_sim = (top->V_VICADDR & 0xff) | (top->V_VICADDR_NOW & 0xff00);
-                  }
-               }
-           }
-
-	   state->cycle_num = top->V_CYCLE_NUM;
-	   state->xpos = top->V_XPOS;
-	   state->raster_line = top->V_RASTER_LINE_D;
-           state->cycleByCycleStepping = cycleByCycle;
-	   state->idle = top->V_IDLE;
-	   state->allow_bad_lines = top->V_ALLOW_BAD_LINES;
-	   state->reg11_delayed = top->V_REG11_DELAYED;
-	   state->vborder = top->V_VBORDER;
-	   state->main_border = top->V_MAIN_BORDER;
-	   state->pps = top->V_PPS;
-	   state->dot4x = top->V_DOT4X ? 1 : 0;
-
            if (top->ce == 0 && top->rw == 1) {
               // Chip selected and read, set data in state
               state->data_from_sim = top->V_DBO;
            }
-           regs_fpga_to_vice(top, state);
+
+           // End of a batch step. Record our digest and stop at the
+           // first step that doesn't match what VICE saw.
+           if (inBatch && ++batchTicks == 4) {
+              struct vicii_batch_in* in = &ipc->batch->in[batchStep];
+              struct vicii_batch_out* out = &ipc->batch->out[batchStep];
+              out->addr_from_sim = addr_fpga_to_vice(top, state);
+              out->data_from_sim = state->data_from_sim;
+              out->ba = top->ba;
+              out->aec = top->aec;
+              out->irq = top->irq;
+              out->phi = top->clk_phi;
+
+              // A replay checks these against what VICE expected
+              if (stimRec) {
+                 stimStep.addr_from_sim = in->expect_addr;
+                 stimStep.data_from_sim = out->data_from_sim;
+                 stimStep.ba = in->expect_ba;
+                 stimStep.aec = in->expect_aec;
+                 stimStep.irq = in->expect_irq;
+                 stimStep.hasRegs = 0;
+                 stim_write();
+              }
+
+              batchStep++;
+              batchTicks = 0;
+              ipc->batch->done = batchStep;
+
+              if (out->addr_from_sim != in->expect_addr ||
+                     out->ba != in->expect_ba ||
+                     out->aec != in->expect_aec ||
+                     out->irq != in->expect_irq) {
+                 ipc->batch->mismatch = batchStep - 1;
+                 LOG(LOG_INFO, "batch mismatch at step %d (cycle=%d, line=%d)",
+                    batchStep - 1, top->V_CYCLE_NUM, top->V_RASTER_LINE);
+                 ticksUntilDone = 1;
+              }
+           }
 
            bool needQuit = false;
            if (state->flags & VICII_OP_CAPTURE_END) {
@@ -1342,12 +2614,20 @@ int main(int argc, char** argv, char** env) {
               needQuit = true;
            }
 
+           // Got all the frames we were asked for. Stop VICE too.
+           if (framesDone) {
+              state->flags |= VICII_OP_CAPTURE_ABORT;
+              keyPressToQuit = false;
+              needQuit = true;
+           }
+
            // After we have one full frame, exit the loop.
            if (captureByFrame &&
               top->V_XPOS == captureByFrameStopXpos &&
                  top->V_RASTER_LINE == captureByFrameStopYpos) {
               state->flags &= ~VICII_OP_CAPTURE_START;
-              ipc_receive_done(ipc);
+              state_fpga_to_vice(top, state, cycleByCycle);
+              shadow_done(top, ipc, state);
               break;
            }
 	   if (viceCapture) {
@@ -1357,15 +2637,12 @@ int main(int argc, char** argv, char** env) {
 		     }
 	      } else if (top->V_XPOS == lastXPos && top->V_RASTER_LINE == screenHeight - 1) {
                state->flags |= VICII_OP_CAPTURE_ABORT;
-               ipc_receive_done(ipc);
-
-               SDL_Surface *sshot = SDL_CreateRGBSurface(0, screenWidth*2, screenHeight*2,
-                   32, 0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000);
-               SDL_RenderReadPixels(ren, NULL, SDL_PIXELFORMAT_ARGB8888,
-                                    sshot->pixels, sshot->pitch);
-               SDL_SaveBMP(sshot, "screenshot.bmp");
-               SDL_FreeSurface(sshot);
-               exit(0);
+               state_fpga_to_vice(top, state, cycleByCycle);
+               shadow_done(top, ipc, state);
+               // The frame is written after the common teardown below
+               viceCaptureDone = true;
+               keyPressToQuit = false;
+               break;
 	     }
 	   }
 
@@ -1373,8 +2650,13 @@ int main(int argc, char** argv, char** env) {
            ticksUntilPhase--;
 
            if (ticksUntilDone == 0 || needQuit) {
+              state_fpga_to_vice(top, state, cycleByCycle);
+              inBatch = false;
               // Do not change state after this line
-              if (ipc_receive_done(ipc))
+              profT = prof_begin();
+              int failed = shadow_done(top, ipc, state);
+              prof_end(PROF_IPC, profT);
+              if (failed)
                  break;
            }
 
@@ -1406,7 +2688,7 @@ int main(int argc, char** argv, char** env) {
 		printf ("(PAUSE NEXT PHASE 1st tick)\n");
 
 		if (showWindow && cycleByCycleCount == 0)
-                   SDL_RenderPresent(ren);
+                   fb_present(fb);
 
 		if (cycleByCycleCount == 0) {
                   bool quit = false;
@@ -1470,26 +2752,98 @@ int main(int argc, char** argv, char** env) {
         if (captureByTime && ticks >= endTicks)
            break;
 
+        if (framesDone) {
+           keyPressToQuit = false;
+           break;
+        }
+
         // Advance simulation time. Each tick represents 1 picosecond.
-        ticks = nextTick(top, tfp, chip);
+        // Shadowing and the bus model change bus inputs before the eval
+        // at the top of the loop so the edge has to be evaluated first.
+        // Otherwise that eval covers it.
+        ticks = nextTick(top, shadowVic || bus);
+
+        if (top->V_RASTER_LINE != lastRasterLine) {
+           if (top->V_RASTER_LINE == 0) {
+              simFrame++;
+              if (stimRec)
+                 st_mark(stimRec, 0, top->V_CYCLE_NUM);
+           }
+           lastRasterLine = top->V_RASTER_LINE;
+        }
+
+        // Periodic --bench-every report. Only look at the clock now and then.
+        if (benchEvery > 0 && (dot4xTicks & 4095) == 0 &&
+               prof_now() - benchLast.ns >= benchEvery * 1e9) {
+           struct prof_mark now;
+           prof_mark(&now, dot4xTicks, ticks);
+           prof_report("bench-every", &benchLast, &now);
+           benchLast = now;
+        }
+
+#if SIM_SAVABLE
+        // Saved here, a restored run picks up right where nextTick left off.
+        if (saveFile && simFrame >= saveFrame) {
+           if (save_snapshot(saveFile, top, chip, simFrame) == 0)
+              LOG(LOG_INFO, "saved %s at frame %d", saveFile, simFrame);
+           keyPressToQuit = false;
+           break;
+        }
+#endif
+    }
+
+    struct prof_mark benchEnd;
+    prof_mark(&benchEnd, dot4xTicks, ticks);
+    if (bench || profile)
+       prof_report("bench", &benchStart, &benchEnd);
+    if (benchJson)
+       prof_write_json(benchJson, &benchStart, &benchEnd);
+
+    if (stimRec) {
+       LOG(LOG_INFO, "recorded %llu steps",
+           (unsigned long long) st_steps(stimRec));
+       if (st_close(stimRec))
+          LOG(LOG_ERROR, "can't write stimulus trace");
+       stimRec = nullptr;
     }
 
-    if (shadowVic) {
+    if (stimPlay) {
+       if (!replayFailed)
+          LOG(LOG_INFO, "replayed %llu steps, no mismatches",
+              (unsigned long long) st_steps(stimPlay));
+       st_close(stimPlay);
+       stimPlay = nullptr;
+    } else if (shadowVic) {
        ipc_close(ipc);
     }
 
-    if (showWindow) {
+    if (fs) {
+       int n = fs_close(fs);
+       fs = nullptr;
+       LOG(LOG_INFO, "streamed %d frames", n);
+    }
 
-       // Instead of waiting for a key, do the capture if requested
-       if (endCapture) {
-          SDL_Surface *sshot = SDL_CreateRGBSurface(0, screenWidth*2, screenHeight*2,
-             32, 0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000);
-          SDL_RenderReadPixels(ren, NULL, SDL_PIXELFORMAT_ARGB8888,
-             sshot->pixels, sshot->pitch);
-          SDL_SaveBMP(sshot, "screenshot.bmp");
-          SDL_FreeSurface(sshot);
-          exit(0);
-       }
+    if (ring) {
+       tr_close(ring);
+       ring = nullptr;
+    }
+
+    if (bus) {
+       bus_destroy(bus);
+       bus = nullptr;
+    }
+
+    // Instead of waiting for a key, do the capture if requested
+    if ((render && endCapture) || viceCaptureDone) {
+       if (frameOut)
+          fd_write(frameOut, fb, screenWidth, screenHeight);
+       else if (render)
+          fb_save_bmp(fb, "screenshot.bmp");
+       keyPressToQuit = false;
+    }
+
+    if (showWindow) {
+       fb_present(fb);
 
        bool quit = false;
        while (!quit && keyPressToQuit) {
@@ -1504,21 +2858,27 @@ int main(int argc, char** argv, char** env) {
            }
        }
 
+       fb_destroy(fb);
+       fb = nullptr;
        SDL_DestroyRenderer(ren);
        SDL_DestroyWindow(win);
        SDL_Quit();
     }
 
+    if (fb) fb_destroy(fb);
+
     // Final model cleanup
     top->final();
 
 #if VM_TRACE
-    if (tfp) { tfp->close(); tfp = NULL; }
+    if (numTriggers && !triggered)
+       LOG(LOG_INFO, "trace trigger never fired");
+    trace_close();
 #endif
 
     // Destroy model
     delete top;
 
     // Fin
-    exit(0);
+    exit(check_report() || replayFailed ? 1 : 0);
 }
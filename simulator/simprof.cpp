@@ -0,0 +1,120 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "log.h"
+#include "simprof.h"
+
+struct sim_prof prof;
+
+static const char* phaseNames[PROF_PHASES] = {
+  "eval", "render", "trace", "ipc"
+};
+
+void prof_start(bool phases) {
+  memset(prof.ns, 0, sizeof(prof.ns));
+  prof.evals = 0;
+  prof.enabled = phases;
+}
+
+void prof_mark(struct prof_mark* m, uint64_t dot4xTicks, uint64_t simPs) {
+  m->ns = prof_now();
+  m->dot4xTicks = dot4xTicks;
+  m->simPs = simPs;
+  m->evals = prof.evals;
+  memcpy(m->phaseNs, prof.ns, sizeof(m->phaseNs));
+}
+
+struct rates {
+  double secs;
+  uint64_t ticks;
+  double ticksPerSec;
+  double simUsPerSec;
+  double evalsPerTick;
+  double phaseSecs[PROF_PHASES];
+  double otherSecs;
+};
+
+static void get_rates(const struct prof_mark* from,
+                      const struct prof_mark* to, struct rates* r) {
+  r->secs = (to->ns - from->ns) / 1e9;
+  if (r->secs <= 0)
+     r->secs = 1e-9;
+  r->ticks = to->dot4xTicks - from->dot4xTicks;
+  r->ticksPerSec = r->ticks / r->secs;
+  r->simUsPerSec = (to->simPs - from->simPs) / 1e6 / r->secs;
+  r->evalsPerTick = r->ticks ?
+     (double) (to->evals - from->evals) / r->ticks : 0;
+  r->otherSecs = r->secs;
+  for (int p = 0; p < PROF_PHASES; p++) {
+     r->phaseSecs[p] = (to->phaseNs[p] - from->phaseNs[p]) / 1e9;
+     r->otherSecs -= r->phaseSecs[p];
+  }
+  if (r->otherSecs < 0)
+     r->otherSecs = 0;
+}
+
+void prof_report(const char* label, const struct prof_mark* from,
+                 const struct prof_mark* to) {
+  struct rates r;
+  get_rates(from, to, &r);
+
+  printf ("%s: %llu dot4x ticks in %.3fs = %.0f ticks/s\n", label,
+          (unsigned long long) r.ticks, r.secs, r.ticksPerSec);
+  printf ("%s: %.1f simulated us/s, %.2f evals/tick\n", label,
+          r.simUsPerSec, r.evalsPerTick);
+  if (!prof.enabled)
+     return;
+  printf ("%s:", label);
+  for (int p = 0; p < PROF_PHASES; p++)
+     printf (" %s %.1f%%", phaseNames[p], 100 * r.phaseSecs[p] / r.secs);
+  printf (" other %.1f%%\n", 100 * r.otherSecs / r.secs);
+}
+
+int prof_write_json(const char* filename, const struct prof_mark* from,
+                    const struct prof_mark* to) {
+  FILE* fo = fopen(filename, "w");
+  if (fo == nullptr) {
+     LOG(LOG_ERROR, "can't open %s", filename);
+     return 1;
+  }
+
+  struct rates r;
+  get_rates(from, to, &r);
+  fprintf(fo, "{\n");
+  fprintf(fo, "  \"seconds\": %.6f,\n", r.secs);
+  fprintf(fo, "  \"dot4x_ticks\": %llu,\n", (unsigned long long) r.ticks);
+  fprintf(fo, "  \"ticks_per_sec\": %.1f,\n", r.ticksPerSec);
+  fprintf(fo, "  \"sim_us_per_sec\": %.3f,\n", r.simUsPerSec);
+  fprintf(fo, "  \"evals\": %llu,\n",
+          (unsigned long long) (to->evals - from->evals));
+  fprintf(fo, "  \"evals_per_tick\": %.3f", r.evalsPerTick);
+  if (prof.enabled) {
+     fprintf(fo, ",\n  \"phase_seconds\": {");
+     for (int p = 0; p < PROF_PHASES; p++)
+        fprintf(fo, "\"%s\": %.6f, ", phaseNames[p], r.phaseSecs[p]);
+     fprintf(fo, "\"other\": %.6f}", r.otherSecs);
+  }
+  fprintf(fo, "\n}\n");
+
+  if (fclose(fo) != 0) {
+     LOG(LOG_ERROR, "failed writing %s", filename);
+     return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,83 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef VICII_SIMPROF_H
+#define VICII_SIMPROF_H
+
+#include <stdint.h>
+#include <time.h>
+
+// Where the simulator's wall time goes (--bench and friends).
+//
+// --bench only counts ticks and evals. Sections of the main loop are
+// bracketed with prof_begin/prof_end, which read the clock only under
+// --profile and are a single branch otherwise, so --bench rates aren't
+// skewed by the timing itself. Time not claimed by a phase is reported
+// as 'other' (clock scheduling, checks, the loop itself).
+
+enum {
+  PROF_EVAL,    // Vtop::eval
+  PROF_RENDER,  // drawing, frame output, window updates
+  PROF_TRACE,   // waveform dumps, the trace ring and -l logging
+  PROF_IPC,     // waiting for VICE (the semop in ipc_receive) and replies
+  PROF_PHASES
+};
+
+struct sim_prof {
+  bool enabled;       // time the phases
+  uint64_t ns[PROF_PHASES];
+  uint64_t evals;
+};
+
+extern struct sim_prof prof;
+
+static inline uint64_t prof_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline uint64_t prof_begin() {
+  return prof.enabled ? prof_now() : 0;
+}
+
+static inline void prof_end(int phase, uint64_t start) {
+  if (prof.enabled)
+     prof.ns[phase] += prof_now() - start;
+}
+
+// A point in the run to report rates against
+struct prof_mark {
+  uint64_t ns;
+  uint64_t dot4xTicks;
+  uint64_t simPs;
+  uint64_t evals;
+  uint64_t phaseNs[PROF_PHASES];
+};
+
+void prof_start(bool phases);
+void prof_mark(struct prof_mark* m, uint64_t dot4xTicks, uint64_t simPs);
+
+// One summary of what happened between two marks on stdout. Lines
+// start with label.
+void prof_report(const char* label, const struct prof_mark* from,
+                 const struct prof_mark* to);
+
+// Same as JSON. Returns 1 on error, 0 success
+int prof_write_json(const char* filename, const struct prof_mark* from,
+                    const struct prof_mark* to);
+
+#endif
@@ -0,0 +1,343 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <zlib.h>
+
+#include "log.h"
+#include "stimtrace.h"
+
+// Record tags
+#define TAG_STEP   0x01
+#define TAG_REPEAT 0x02
+#define TAG_SYNC   0x03
+#define TAG_MARK   0x04
+#define TAG_END    0x05
+
+// Step change mask
+#define CH_IN_ADDR   (1 << 0)
+#define CH_IN_DATA   (1 << 1)
+#define CH_IN_CTRL   (1 << 2)
+#define CH_IN_FLAGS  (1 << 3)
+#define CH_OUT_ADDR  (1 << 4)
+#define CH_OUT_DATA  (1 << 5)
+#define CH_OUT_CTRL  (1 << 6)
+#define CH_OUT_REGS  (1 << 7)
+
+struct stimtrace_hdr {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t chip;
+  uint32_t stateSize;
+};
+
+struct stimtrace {
+  gzFile gz;
+  bool writing;
+  bool failed;
+  int chip;
+  uint64_t steps;
+  struct stim_step last;
+  uint64_t repeat;  // writer: pending, reader: remaining
+};
+
+static void put8(struct stimtrace* st, unsigned int v) {
+  if (gzputc(st->gz, v & 0xff) == -1)
+     st->failed = true;
+}
+
+static void put16(struct stimtrace* st, unsigned int v) {
+  put8(st, v);
+  put8(st, v >> 8);
+}
+
+static void put_varint(struct stimtrace* st, uint64_t v) {
+  while (v >= 0x80) {
+     put8(st, (v & 0x7f) | 0x80);
+     v >>= 7;
+  }
+  put8(st, v);
+}
+
+static int get8(struct stimtrace* st) {
+  int c = gzgetc(st->gz);
+  if (c == -1)
+     st->failed = true;
+  return c & 0xff;
+}
+
+static int get16(struct stimtrace* st) {
+  int lo = get8(st);
+  return lo | (get8(st) << 8);
+}
+
+static uint64_t get_varint(struct stimtrace* st) {
+  uint64_t v = 0;
+  for (int shift = 0; shift < 64 && !st->failed; shift += 7) {
+     int c = get8(st);
+     v |= (uint64_t) (c & 0x7f) << shift;
+     if ((c & 0x80) == 0)
+        break;
+  }
+  return v;
+}
+
+static void flush_repeat(struct stimtrace* st) {
+  if (st->repeat == 0)
+     return;
+  put8(st, TAG_REPEAT);
+  put_varint(st, st->repeat);
+  st->repeat = 0;
+}
+
+struct stimtrace* st_create(const char* filename, int chip) {
+  gzFile gz = gzopen(filename, "wb6");
+  if (gz == nullptr) {
+     LOG(LOG_ERROR, "can't create %s", filename);
+     return nullptr;
+  }
+
+  struct stimtrace_hdr hdr;
+  hdr.magic = ST_MAGIC;
+  hdr.version = ST_VERSION;
+  hdr.chip = chip;
+  hdr.stateSize = sizeof(struct vicii_state);
+  if (gzwrite(gz, &hdr, sizeof(hdr)) != (int) sizeof(hdr)) {
+     LOG(LOG_ERROR, "can't write %s", filename);
+     gzclose(gz);
+     return nullptr;
+  }
+
+  struct stimtrace* st = (struct stimtrace*) calloc(1, sizeof(struct stimtrace));
+  st->gz = gz;
+  st->writing = true;
+  st->chip = chip;
+  return st;
+}
+
+struct stimtrace* st_open(const char* filename) {
+  gzFile gz = gzopen(filename, "rb");
+  if (gz == nullptr) {
+     LOG(LOG_ERROR, "can't open %s", filename);
+     return nullptr;
+  }
+
+  struct stimtrace_hdr hdr;
+  if (gzread(gz, &hdr, sizeof(hdr)) != (int) sizeof(hdr) ||
+         hdr.magic != ST_MAGIC) {
+     LOG(LOG_ERROR, "%s is not a stimulus trace", filename);
+     gzclose(gz);
+     return nullptr;
+  }
+  if (hdr.version != ST_VERSION ||
+         hdr.stateSize != sizeof(struct vicii_state)) {
+     LOG(LOG_ERROR, "%s was recorded by a different simulator version",
+         filename);
+     gzclose(gz);
+     return nullptr;
+  }
+
+  struct stimtrace* st = (struct stimtrace*) calloc(1, sizeof(struct stimtrace));
+  st->gz = gz;
+  st->chip = hdr.chip;
+  return st;
+}
+
+int st_chip(struct stimtrace* st) {
+  return st->chip;
+}
+
+uint64_t st_steps(struct stimtrace* st) {
+  return st->steps;
+}
+
+int st_write(struct stimtrace* st, const struct stim_step* step,
+             const struct vicii_state* sync) {
+  const struct stim_step* l = &st->last;
+  int nregs = 0;
+  unsigned char mask = 0;
+
+  if (step->addr_to_sim != l->addr_to_sim) mask |= CH_IN_ADDR;
+  if (step->data_to_sim != l->data_to_sim) mask |= CH_IN_DATA;
+  if (step->ce != l->ce || step->rw != l->rw || step->lp != l->lp)
+     mask |= CH_IN_CTRL;
+  if (step->flags != l->flags) mask |= CH_IN_FLAGS;
+  if (step->addr_from_sim != l->addr_from_sim) mask |= CH_OUT_ADDR;
+  if (step->data_from_sim != l->data_from_sim) mask |= CH_OUT_DATA;
+  if (step->ba != l->ba || step->aec != l->aec || step->irq != l->irq ||
+         step->hasRegs != l->hasRegs)
+     mask |= CH_OUT_CTRL;
+  if (step->hasRegs) {
+     for (int r = 0; r < 64; r++)
+        if (step->regs[r] != l->regs[r])
+           nregs++;
+     if (nregs)
+        mask |= CH_OUT_REGS;
+  }
+
+  st->steps++;
+
+  if (mask == 0 && sync == nullptr) {
+     st->repeat++;
+     return st->failed;
+  }
+
+  flush_repeat(st);
+
+  if (sync) {
+     put8(st, TAG_SYNC);
+     if (gzwrite(st->gz, sync, sizeof(*sync)) != (int) sizeof(*sync))
+        st->failed = true;
+  }
+
+  put8(st, TAG_STEP);
+  put8(st, mask);
+  if (mask & CH_IN_ADDR) put16(st, step->addr_to_sim);
+  if (mask & CH_IN_DATA) put16(st, step->data_to_sim);
+  if (mask & CH_IN_CTRL)
+     put8(st, (step->ce & 1) | (step->rw & 1) << 1 | (step->lp & 1) << 2);
+  if (mask & CH_IN_FLAGS) put8(st, step->flags);
+  if (mask & CH_OUT_ADDR) put16(st, step->addr_from_sim);
+  if (mask & CH_OUT_DATA) put16(st, step->data_from_sim);
+  if (mask & CH_OUT_CTRL)
+     put8(st, (step->ba & 1) | (step->aec & 1) << 1 | (step->irq & 1) << 2 |
+                 (step->hasRegs ? 8 : 0));
+  if (mask & CH_OUT_REGS) {
+     put8(st, nregs);
+     for (int r = 0; r < 64; r++) {
+        if (step->regs[r] != l->regs[r]) {
+           put8(st, r);
+           put8(st, step->regs[r]);
+        }
+     }
+  }
+
+  // Registers carry over steps that don't have them, so a batch in
+  // between doesn't make the next lockstep step look like a change.
+  uint8_t regs[64];
+  memcpy(regs, l->regs, sizeof(regs));
+  st->last = *step;
+  if (!step->hasRegs)
+     memcpy(st->last.regs, regs, sizeof(regs));
+
+  return st->failed;
+}
+
+int st_mark(struct stimtrace* st, int rasterLine, int cycle) {
+  flush_repeat(st);
+  put8(st, TAG_MARK);
+  put_varint(st, st->steps);
+  put16(st, rasterLine);
+  put8(st, cycle);
+  return st->failed;
+}
+
+static int read_step(struct stimtrace* st, struct stim_step* step) {
+  struct stim_step* l = &st->last;
+  int mask = get8(st);
+
+  if (mask & CH_IN_ADDR) l->addr_to_sim = get16(st);
+  if (mask & CH_IN_DATA) l->data_to_sim = get16(st);
+  if (mask & CH_IN_CTRL) {
+     int v = get8(st);
+     l->ce = v & 1;
+     l->rw = (v >> 1) & 1;
+     l->lp = (v >> 2) & 1;
+  }
+  if (mask & CH_IN_FLAGS) l->flags = get8(st);
+  if (mask & CH_OUT_ADDR) l->addr_from_sim = get16(st);
+  if (mask & CH_OUT_DATA) l->data_from_sim = get16(st);
+  if (mask & CH_OUT_CTRL) {
+     int v = get8(st);
+     l->ba = v & 1;
+     l->aec = (v >> 1) & 1;
+     l->irq = (v >> 2) & 1;
+     l->hasRegs = (v >> 3) & 1;
+  }
+  if (mask & CH_OUT_REGS) {
+     int n = get8(st);
+     for (int i = 0; i < n; i++) {
+        int r = get8(st);
+        l->regs[r & 63] = get8(st);
+     }
+  }
+
+  if (st->failed) {
+     LOG(LOG_ERROR, "stimulus trace truncated at step %llu",
+         (unsigned long long) st->steps);
+     return ST_ERROR;
+  }
+  *step = *l;
+  st->steps++;
+  return ST_STEP;
+}
+
+int st_read(struct stimtrace* st, struct stim_step* step,
+            struct vicii_state* sync) {
+  if (st->repeat > 0) {
+     st->repeat--;
+     *step = st->last;
+     st->steps++;
+     return ST_STEP;
+  }
+
+  while (true) {
+     int tag = gzgetc(st->gz);
+     switch (tag) {
+        case TAG_STEP:
+           return read_step(st, step);
+        case TAG_REPEAT:
+           st->repeat = get_varint(st);
+           if (st->repeat == 0 || st->failed)
+              break;
+           return st_read(st, step, sync);
+        case TAG_SYNC:
+           if (gzread(st->gz, sync, sizeof(*sync)) != (int) sizeof(*sync) ||
+                  gzgetc(st->gz) != TAG_STEP)
+              break;
+           return read_step(st, step) == ST_STEP ? ST_SYNC : ST_ERROR;
+        case TAG_MARK:
+           get_varint(st);
+           get16(st);
+           get8(st);
+           if (st->failed)
+              break;
+           continue;
+        case TAG_END:
+           return ST_END;
+        default:
+           break;
+     }
+     LOG(LOG_ERROR, "bad stimulus trace at step %llu",
+         (unsigned long long) st->steps);
+     return ST_ERROR;
+  }
+}
+
+int st_close(struct stimtrace* st) {
+  int failed = 0;
+  if (st->writing) {
+     flush_repeat(st);
+     put8(st, TAG_END);
+     failed = st->failed;
+  }
+  if (gzclose(st->gz) != Z_OK && st->writing)
+     failed = 1;
+  free(st);
+  return failed;
+}
@@ -0,0 +1,100 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef VICII_STIMTRACE_H
+#define VICII_STIMTRACE_H
+
+#include <stdint.h>
+
+extern "C" {
+#include "vicii_ipc.h"
+}
+
+// CPU bus stimulus traces
+//
+// A shadowed run (-z --record) logs every exchange with VICE: the bus
+// inputs VICE drove for the step and the outputs that VICE accepted.
+// A later run (--replay) feeds the same inputs to the model and checks
+// the outputs without VICE. Lockstep exchanges record what the model
+// answered (VICE compared it), batched steps record what VICE expected.
+//
+// The file is a gzip stream. Each step only stores the fields that
+// changed since the previous one and runs of identical steps are
+// collapsed, so a frame of mostly idle bus costs a few KB.
+//
+//    header   magic, version, chip
+//    SYNC     full vicii_state, then the step that follows it
+//    STEP     change mask, changed fields, register deltas
+//    REPEAT   varint count of steps identical to the last
+//    MARK     step index, raster line and cycle (once per frame)
+//    END
+
+#define ST_MAGIC   0x4d495453 // 'STIM'
+#define ST_VERSION 1
+
+// One exchange: 4 dot4x ticks (1 right after a SYNC)
+struct stim_step {
+  // inputs
+  uint16_t addr_to_sim;
+  uint16_t data_to_sim;
+  uint8_t ce;
+  uint8_t rw;
+  uint8_t lp;
+  uint8_t flags;     // VICII_OP_* bits that matter for replay
+
+  // expected outputs
+  uint16_t addr_from_sim;
+  uint16_t data_from_sim;
+  uint8_t ba;
+  uint8_t aec;
+  uint8_t irq;
+  uint8_t hasRegs;   // regs is valid (lockstep steps only)
+  uint8_t regs[64];
+};
+
+// st_read results
+#define ST_STEP  0
+#define ST_SYNC  1  // sync state filled in, followed by its step
+#define ST_END   2
+#define ST_ERROR -1
+
+struct stimtrace;
+
+// Returns nullptr on error.
+struct stimtrace* st_create(const char* filename, int chip);
+struct stimtrace* st_open(const char* filename);
+
+int st_chip(struct stimtrace* st);
+
+// Steps seen so far (written or read)
+uint64_t st_steps(struct stimtrace* st);
+
+// Append a step. sync is the state VICE sent with VICII_OP_SYNC_STATE
+// when this step follows one, otherwise nullptr.
+int st_write(struct stimtrace* st, const struct stim_step* step,
+             const struct vicii_state* sync);
+
+// Note where a frame starts, for reports and seeking.
+int st_mark(struct stimtrace* st, int rasterLine, int cycle);
+
+// Next step. Marks are skipped. On ST_SYNC, sync is filled in too.
+int st_read(struct stimtrace* st, struct stim_step* step,
+            struct vicii_state* sync);
+
+// Flushes and closes. Returns non-zero if anything failed to write.
+int st_close(struct stimtrace* st);
+
+#endif
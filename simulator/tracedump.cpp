@@ -0,0 +1,123 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+// Print the records of a trace ring written by vicsim --ring.
+//
+// Usage: tracedump [-l first:last] [-c first:last] [-n count] [-d] ring
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "tracering.h"
+
+static int parseRange(const char* arg, int* first, int* last) {
+  if (sscanf(arg, "%d:%d", first, last) == 2)
+     return 0;
+  if (sscanf(arg, "%d", first) == 1) {
+     *last = *first;
+     return 0;
+  }
+  return 1;
+}
+
+static void usage() {
+  printf ("Usage: tracedump [options] ring\n");
+  printf ("  -l first:last : only raster lines first..last\n");
+  printf ("  -c first:last : only cycles first..last\n");
+  printf ("  -n count      : only the last count matching records\n");
+  printf ("  -d            : only records on a dot clock rising edge\n");
+}
+
+int main(int argc, char** argv) {
+  int lineFirst = 0, lineLast = 0xffff;
+  int cycleFirst = 0, cycleLast = 0xff;
+  long count = -1;
+  bool dotOnly = false;
+  int c;
+
+  while ((c = getopt(argc, argv, "l:c:n:dh")) != -1) {
+    switch (c) {
+      case 'l':
+        if (parseRange(optarg, &lineFirst, &lineLast)) {
+          usage();
+          return 1;
+        }
+        break;
+      case 'c':
+        if (parseRange(optarg, &cycleFirst, &cycleLast)) {
+          usage();
+          return 1;
+        }
+        break;
+      case 'n':
+        count = atol(optarg);
+        break;
+      case 'd':
+        dotOnly = true;
+        break;
+      default:
+        usage();
+        return c == 'h' ? 0 : 1;
+    }
+  }
+
+  if (optind >= argc) {
+    usage();
+    return 1;
+  }
+
+  struct trace_ring* tr = tr_map(argv[optind]);
+  if (tr == nullptr)
+    return 1;
+
+  uint64_t n = tr_size(tr);
+  uint64_t start = 0;
+
+  // Walk back to find where the last 'count' matches begin
+  if (count >= 0) {
+    start = n;
+    long found = 0;
+    while (start > 0 && found < count) {
+      struct trace_rec* r = tr_get(tr, start - 1);
+      if (r->raster_line >= lineFirst && r->raster_line <= lineLast &&
+          r->cycle_num >= cycleFirst && r->cycle_num <= cycleLast &&
+          (!dotOnly || (r->flags & TR_DOT_RISING)))
+        found++;
+      start--;
+    }
+  }
+
+  printf ("%llu of %llu records, chip %u\n",
+          (unsigned long long) n, (unsigned long long) tr->hdr->count,
+          tr->hdr->chip);
+  tr_print_header(stdout);
+
+  for (uint64_t i = start; i < n; i++) {
+    struct trace_rec* r = tr_get(tr, i);
+    if (r->raster_line < lineFirst || r->raster_line > lineLast)
+      continue;
+    if (r->cycle_num < cycleFirst || r->cycle_num > cycleLast)
+      continue;
+    if (dotOnly && !(r->flags & TR_DOT_RISING))
+      continue;
+    tr_print(stdout, r);
+  }
+
+  tr_close(tr);
+  return 0;
+}
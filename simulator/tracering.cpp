@@ -0,0 +1,163 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "constants.h"
+#include "log.h"
+#include "tracering.h"
+
+struct trace_ring* tr_create(const char* filename, uint64_t capacity,
+                             int chip) {
+  int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+     LOG(LOG_ERROR, "can't create trace ring %s", filename);
+     return nullptr;
+  }
+
+  size_t len = sizeof(struct trace_ring_hdr) +
+     capacity * sizeof(struct trace_rec);
+  if (ftruncate(fd, len) < 0) {
+     LOG(LOG_ERROR, "can't size trace ring %s", filename);
+     close(fd);
+     return nullptr;
+  }
+
+  void* mem = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mem == MAP_FAILED) {
+     LOG(LOG_ERROR, "can't map trace ring %s", filename);
+     close(fd);
+     return nullptr;
+  }
+
+  struct trace_ring* tr = new trace_ring();
+  tr->fd = fd;
+  tr->len = len;
+  tr->hdr = (struct trace_ring_hdr*) mem;
+  tr->recs = (struct trace_rec*) (tr->hdr + 1);
+
+  memset(tr->hdr, 0, sizeof(struct trace_ring_hdr));
+  tr->hdr->magic = TR_MAGIC;
+  tr->hdr->version = TR_VERSION;
+  tr->hdr->recSize = sizeof(struct trace_rec);
+  tr->hdr->chip = chip;
+  tr->hdr->capacity = capacity;
+  return tr;
+}
+
+struct trace_ring* tr_map(const char* filename) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+     LOG(LOG_ERROR, "can't open trace ring %s", filename);
+     return nullptr;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(struct trace_ring_hdr)) {
+     LOG(LOG_ERROR, "%s is not a trace ring", filename);
+     close(fd);
+     return nullptr;
+  }
+
+  void* mem = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (mem == MAP_FAILED) {
+     LOG(LOG_ERROR, "can't map trace ring %s", filename);
+     close(fd);
+     return nullptr;
+  }
+
+  struct trace_ring_hdr* hdr = (struct trace_ring_hdr*) mem;
+  if (hdr->magic != TR_MAGIC || hdr->version != TR_VERSION ||
+      hdr->recSize != sizeof(struct trace_rec) ||
+      sizeof(struct trace_ring_hdr) + hdr->capacity * hdr->recSize >
+         (size_t) st.st_size) {
+     LOG(LOG_ERROR, "%s is not a version %d trace ring", filename, TR_VERSION);
+     munmap(mem, st.st_size);
+     close(fd);
+     return nullptr;
+  }
+
+  struct trace_ring* tr = new trace_ring();
+  tr->fd = fd;
+  tr->len = st.st_size;
+  tr->hdr = hdr;
+  tr->recs = (struct trace_rec*) (hdr + 1);
+  return tr;
+}
+
+void tr_close(struct trace_ring* tr) {
+  munmap(tr->hdr, tr->len);
+  close(tr->fd);
+  delete tr;
+}
+
+static char cycleToChar(int cycle) {
+  static const char chars[16] = {
+     '#', 'i', 's', 'r', 'g', 'S', 'I', 'I',
+     'S', 'I', 'C', 'C', 'I', 'I', 'i', 'x' };
+  return chars[cycle & 15];
+}
+
+#define FLAG(r, f) ((r)->flags & (f) ? 1 : 0)
+
+void tr_print_header(FILE* fo) {
+  fprintf (fo, "  TICKS(ns)    D4X CNT POS CYC DOTR PHI BIT IRQ BA AEC VCY RAS CAS"
+               "  X   Y   Y   ADI  ADO  DBI DBO RW CE RFC PPS              BL"
+               " MC  MCB RC VADDR BMM\n");
+}
+
+void tr_print(FILE* fo, const struct trace_rec* r) {
+  fprintf (fo, "%c %012llu %01d   %02d  %03x  %02d  %01d    %01d   %01d   %01d  "
+           " %01d  %01d  %c   %01d   %01d  %03d %03d %03d %04x %04x  %02x"
+           "  %02x %01d  %01d  %02x %s %d  %03d %03d %01d  %04x  %01d\n",
+           r->flags & TR_RST ? 'R' : r->flags & TR_DOT_RISING ? '*' : ' ',
+           (unsigned long long) (r->ticks / TICKS_TO_TIMESCALE),
+           FLAG(r, TR_DOT4X),
+           r->clk_cnt,
+           r->xpos,
+           r->cycle_num,
+           FLAG(r, TR_DOTR),
+           FLAG(r, TR_PHI),
+           r->cycle_bit,
+           FLAG(r, TR_IRQ),
+           FLAG(r, TR_BA),
+           FLAG(r, TR_AEC),
+           cycleToChar(r->cycle_type),
+           FLAG(r, TR_RAS),
+           FLAG(r, TR_CAS),
+           r->raster_x,
+           r->raster_line,
+           r->raster_line_d,
+           r->adi,
+           r->ado,
+           r->dbi,
+           r->dbo,
+           FLAG(r, TR_RW),
+           FLAG(r, TR_CE),
+           r->refc,
+           toBin(16, r->pps),
+           FLAG(r, TR_BADLINE),
+           r->sprite_mc0,
+           r->sprite_mcbase0,
+           r->rc,
+           r->vicaddr,
+           FLAG(r, TR_BMM));
+}
@@ -0,0 +1,128 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef VICII_TRACERING_H
+#define VICII_TRACERING_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
+
+// Binary trace ring
+//
+// One fixed size record per dot4x tick is written into a memory mapped
+// file. Once the ring is full the oldest records are overwritten, so the
+// file always holds the last 'capacity' ticks. Use tracedump to filter
+// and print it.
+
+#define TR_MAGIC   0x474e5254 // 'TRNG'
+#define TR_VERSION 1
+
+// About 40MB, a PAL frame and a half of dot4x ticks
+#define TR_DEFAULT_CAPACITY (1024 * 1024)
+
+// Record flags
+#define TR_DOT4X      (1 << 0)
+#define TR_DOT_RISING (1 << 1)
+#define TR_DOTR       (1 << 2)
+#define TR_PHI        (1 << 3)
+#define TR_IRQ        (1 << 4)
+#define TR_BA         (1 << 5)
+#define TR_AEC        (1 << 6)
+#define TR_RAS        (1 << 7)
+#define TR_CAS        (1 << 8)
+#define TR_RW         (1 << 9)
+#define TR_CE         (1 << 10)
+#define TR_BADLINE    (1 << 11)
+#define TR_BMM        (1 << 12)
+#define TR_RST        (1 << 13)
+
+struct trace_rec {
+  uint64_t ticks;
+  uint16_t xpos;
+  uint16_t raster_x;
+  uint16_t raster_line;
+  uint16_t raster_line_d;
+  uint16_t adi;
+  uint16_t ado;
+  uint16_t dbo;
+  uint16_t vicaddr;
+  uint16_t pps;
+  uint8_t dbi;
+  uint8_t cycle_num;
+  uint8_t cycle_bit;
+  uint8_t cycle_type;
+  uint8_t clk_cnt;
+  uint8_t refc;
+  uint8_t rc;
+  uint8_t sprite_mc0;
+  uint8_t sprite_mcbase0;
+  uint8_t pad;
+  uint32_t flags;
+};
+
+struct trace_ring_hdr {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t recSize;
+  uint32_t chip;
+  uint64_t capacity;  // records
+  uint64_t count;     // records ever written
+  char pad[32];
+};
+
+struct trace_ring {
+  int fd;
+  size_t len;
+  struct trace_ring_hdr* hdr;
+  struct trace_rec* recs;
+};
+
+// Create (or truncate) filename with room for capacity records.
+// Returns nullptr on error.
+struct trace_ring* tr_create(const char* filename, uint64_t capacity, int chip);
+
+// Map an existing ring read only. Returns nullptr on error.
+struct trace_ring* tr_map(const char* filename);
+
+void tr_close(struct trace_ring* tr);
+
+// Slot for the next record. Fill it in then tr_commit.
+static inline struct trace_rec* tr_next(struct trace_ring* tr) {
+  return &tr->recs[tr->hdr->count % tr->hdr->capacity];
+}
+
+static inline void tr_commit(struct trace_ring* tr) {
+  tr->hdr->count++;
+}
+
+// Number of records held (at most capacity)
+static inline uint64_t tr_size(struct trace_ring* tr) {
+  return tr->hdr->count < tr->hdr->capacity ?
+     tr->hdr->count : tr->hdr->capacity;
+}
+
+// One line per record, in the same columns as the -l 4 log
+void tr_print_header(FILE* fo);
+void tr_print(FILE* fo, const struct trace_rec* r);
+
+// i-th oldest record held, 0 <= i < tr_size
+static inline struct trace_rec* tr_get(struct trace_ring* tr, uint64_t i) {
+  uint64_t first = tr->hdr->count - tr_size(tr);
+  return &tr->recs[(first + i) % tr->hdr->capacity];
+}
+
+#endif
@@ -27,11 +27,86 @@
 #include <sys/sem.h>
 #include <sys/shm.h>
 #include <math.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
 
 #include "vicii_ipc.h"
 
+#ifdef IPC_USE_FUTEX
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
 #define MODULE_NAME "ipc"
 
+#ifdef IPC_USE_FUTEX
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+static int futex_timed(volatile int* addr, int op, int val,
+                       const struct timespec* timeout) {
+  return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+static int futex(volatile int* addr, int op, int val) {
+  return futex_timed(addr, op, val, NULL);
+}
+
+// Take one from the count if there is one.
+static inline int try_take(struct vicii_ipc_sem* sem) {
+  int c = __atomic_load_n(&sem->count, __ATOMIC_ACQUIRE);
+  while (c > 0) {
+    if (__atomic_compare_exchange_n(&sem->count, &c, c - 1, 0,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+      return 1;
+  }
+  return 0;
+}
+
+static int v(struct vicii_ipc* ipc, int semaphore) {
+  struct vicii_ipc_sem* sem = &ipc->shm->sems[semaphore];
+  __atomic_fetch_add(&sem->count, 1, __ATOMIC_RELEASE);
+  if (__atomic_load_n(&sem->waiters, __ATOMIC_SEQ_CST) > 0) {
+    if (futex(&sem->count, FUTEX_WAKE, 1) < 0) {
+      fprintf(stderr, "%s: can't do v op\n", MODULE_NAME);
+      perror("REASON");
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int p(struct vicii_ipc* ipc, int semaphore) {
+  struct vicii_ipc_sem* sem = &ipc->shm->sems[semaphore];
+
+  for (int i = 0; i < ipc->spinCount; i++) {
+    if (try_take(sem))
+      return 0;
+    cpu_relax();
+  }
+
+  __atomic_fetch_add(&sem->waiters, 1, __ATOMIC_SEQ_CST);
+  while (!try_take(sem)) {
+    // Only sleeps if count is still 0 when the kernel looks at it.
+    if (futex(&sem->count, FUTEX_WAIT, 0) < 0 &&
+        errno != EAGAIN && errno != EINTR) {
+      __atomic_fetch_sub(&sem->waiters, 1, __ATOMIC_SEQ_CST);
+      fprintf(stderr, "%s: can't do p op\n", MODULE_NAME);
+      perror("REASON");
+      return 1;
+    }
+  }
+  __atomic_fetch_sub(&sem->waiters, 1, __ATOMIC_SEQ_CST);
+  return 0;
+}
+
+#else
+
 static int v(struct vicii_ipc* ipc, int semaphore) {
   ipc->operation[semaphore][0].sem_num = semaphore;
   ipc->operation[semaphore][0].sem_op = 1;
@@ -56,24 +131,66 @@ static int p(struct vicii_ipc* ipc, int semaphore) {
   return 0;
 }
 
+#endif
+
 struct vicii_ipc* ipc_init(int endPoint) {
    struct vicii_ipc* ipc = (struct vicii_ipc*)
        malloc(sizeof(struct vicii_ipc));
    ipc->endPoint = endPoint;
-   ipc->semsKey = 1240;
-   ipc->bufKey = 1241;
+   ipc->shm = NULL;
+   ipc->state = NULL;
+   ipc->batch = NULL;
+   ipc->spinCount = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? IPC_SPIN_COUNT : 0;
+   if (getenv("VICII_IPC_SPIN"))
+      ipc->spinCount = atoi(getenv("VICII_IPC_SPIN"));
+   ipc_set_key(ipc, IPC_DEFAULT_KEY);
+   if (getenv("VICII_IPC_KEY"))
+      ipc_set_key(ipc, atoi(getenv("VICII_IPC_KEY")));
    return ipc;
 }
 
+void ipc_set_key(struct vicii_ipc* ipc, int key) {
+   ipc->semsKey = key;
+   ipc->bufKey = key + 1;
+}
+
+// A crashed or killed session leaves its segment behind. If it has a
+// different size (older IPC_VERSION) shmget would fail outright so get
+// rid of it as long as no one is still attached.
+static void remove_stale(struct vicii_ipc* ipc) {
+  int id = shmget(ipc->bufKey, 0, 0);
+  if (id < 0)
+    return;
+
+  struct shmid_ds ds;
+  if (shmctl(id, IPC_STAT, &ds) < 0)
+    return;
+
+  if (ds.shm_nattch > 0) {
+    fprintf(stderr, "%s: key %d still attached by %d process(es), reusing\n",
+            MODULE_NAME, ipc->bufKey, (int)ds.shm_nattch);
+    return;
+  }
+
+  shmctl(id, IPC_RMID, NULL);
+#ifndef IPC_USE_FUTEX
+  id = semget(ipc->semsKey, 0, 0);
+  if (id >= 0)
+    semctl(id, 0, IPC_RMID);
+#endif
+}
+
 int ipc_open(struct vicii_ipc* ipc) {
   int mode;
 
   if (ipc->endPoint == IPC_RECEIVER) {
     mode = IPC_CREAT;
+    remove_stale(ipc);
   } else {
     mode = 0;
   }
 
+#ifndef IPC_USE_FUTEX
   ipc->semsId = semget(ipc->semsKey, 4, mode | 0666);
   if (ipc->semsId < 0) {
     fprintf(stderr, "%s: can't create semaphore\n", MODULE_NAME);
@@ -91,33 +208,65 @@ int ipc_open(struct vicii_ipc* ipc) {
       }
     }
   }
+#endif
 
-  ipc->bufShmId = shmget(ipc->bufKey, IPC_BUFSIZE, mode | 0644);
+  ipc->bufShmId = shmget(ipc->bufKey, sizeof(struct vicii_ipc_shm),
+                         mode | 0644);
   if (ipc->bufShmId < 0) {
     fprintf(stderr, "%s: can't allocate shared memory segment for outbuf %d\n",
-            MODULE_NAME, IPC_BUFSIZE);
+            MODULE_NAME, (int)sizeof(struct vicii_ipc_shm));
     perror("REASON");
     return -1;
   }
 
-  ipc->state = (struct vicii_state*)shmat(ipc->bufShmId, NULL, 0);
+  ipc->shm = (struct vicii_ipc_shm*)shmat(ipc->bufShmId, NULL, 0);
+  if (ipc->shm == (void*)-1) {
+    fprintf(stderr, "%s: can't allocate dsp buffer\n", MODULE_NAME);
+    ipc->shm = NULL;
+    return -1;
+  }
+
+  if (ipc->endPoint == IPC_RECEIVER) {
+    // The originating end sets up the header and all semaphores to 0
+    memset(ipc->shm, 0, sizeof(struct vicii_ipc_shm));
+    ipc->shm->version = IPC_VERSION;
+    __atomic_store_n(&ipc->shm->magic, IPC_MAGIC, __ATOMIC_RELEASE);
+  } else if (__atomic_load_n(&ipc->shm->magic, __ATOMIC_ACQUIRE) != IPC_MAGIC ||
+             ipc->shm->version != IPC_VERSION) {
+    fprintf(stderr, "%s: shared memory is not IPC version %d\n",
+            MODULE_NAME, IPC_VERSION);
+    shmdt(ipc->shm);
+    ipc->shm = NULL;
+    return -1;
+  }
+
+  ipc->state = (struct vicii_state*)ipc->shm->buf;
+  ipc->batch = &ipc->shm->batch;
   memset(ipc->state, 0, IPC_BUFSIZE);
+  ipc->state->version = VICII_STATE_VERSION;
+  ipc->state->size = sizeof(struct vicii_state);
   ipc->state->enabled = 1;
   ipc->state->rw = 1;
   ipc->state->ce = 1;
 
-  if (ipc->state == NULL) {
-    fprintf(stderr, "%s: can't allocate dsp buffer\n", MODULE_NAME);
-    return -1;
-  }
-
   return 0;
 }
 
 void ipc_close(struct vicii_ipc* ipc) {
   // Now free up all the memory and close handles
-  shmdt(ipc->state);
+  if (ipc->shm) {
+    shmdt(ipc->shm);
+    // The segment goes away once the other end detaches too
+    if (ipc->endPoint == IPC_RECEIVER) {
+      shmctl(ipc->bufShmId, IPC_RMID, NULL);
+#ifndef IPC_USE_FUTEX
+      semctl(ipc->semsId, 0, IPC_RMID);
+#endif
+    }
+  }
+  ipc->shm = NULL;
   ipc->state = NULL;
+  ipc->batch = NULL;
   free(ipc);
 }
 
@@ -144,6 +293,7 @@ int ipc_receive(struct vicii_ipc* ipc) {
       if (p(ipc, END2_PRODUCER_SIG_END1_CONSUME_OK))
          return 1;
     }
+    return 0;
 }
 
 int ipc_receive_done(struct vicii_ipc* ipc) {
@@ -156,3 +306,43 @@ int ipc_receive_done(struct vicii_ipc* ipc) {
     }
     return 0;
 }
+
+static long long now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void ipc_announce(struct vicii_ipc* ipc, int frame, unsigned long long cycle) {
+  __atomic_store_n(&ipc->shm->vice_cycle, cycle, __ATOMIC_RELAXED);
+  __atomic_store_n(&ipc->shm->vice_frame, frame, __ATOMIC_SEQ_CST);
+#ifdef IPC_USE_FUTEX
+  if (__atomic_load_n(&ipc->shm->frame_waiters, __ATOMIC_SEQ_CST) > 0)
+    futex(&ipc->shm->vice_frame, FUTEX_WAKE, INT_MAX);
+#endif
+}
+
+int ipc_wait_frame(struct vicii_ipc* ipc, int frame, int timeoutMs) {
+  long long deadline = now_ms() + timeoutMs;
+  int rc = 0;
+
+  __atomic_fetch_add(&ipc->shm->frame_waiters, 1, __ATOMIC_SEQ_CST);
+  while (1) {
+    int seen = __atomic_load_n(&ipc->shm->vice_frame, __ATOMIC_SEQ_CST);
+    if (seen >= frame)
+      break;
+    if (timeoutMs > 0 && now_ms() >= deadline) {
+      rc = 1;
+      break;
+    }
+#ifdef IPC_USE_FUTEX
+    // Wake up now and then to check the deadline
+    struct timespec slice = { 0, 100 * 1000000 };
+    futex_timed(&ipc->shm->vice_frame, FUTEX_WAIT, seen, &slice);
+#else
+    usleep(1000);
+#endif
+  }
+  __atomic_fetch_sub(&ipc->shm->frame_waiters, 1, __ATOMIC_SEQ_CST);
+  return rc;
+}
@@ -26,6 +26,14 @@
 // can coordinate request/responses using ipc_receive()
 // or ipc_send() functions.
 
+// IPC v2: On Linux, the four handshake semaphores live in the
+// shared memory segment itself as futex words.  Posting is a single
+// atomic add (plus a wake only if the other side is sleeping) and
+// waiting spins for up to IPC_SPIN_COUNT polls before falling back to
+// a futex wait.  When both processes have a core to themselves, an
+// exchange completes without any system calls.  Other platforms
+// keep using SysV semaphores.  The ipc_* API is unchanged.
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <sys/sem.h>
@@ -50,41 +58,82 @@ union semun {
 #define VICII_OP_CAPTURE_ONE_FRAME 16
 // Abort
 #define VICII_OP_CAPTURE_ABORT   32
+// This request carries a window of steps in the batch area (see below)
+#define VICII_OP_BATCH   64
+
+// State layout version. Bump whenever struct vicii_state changes.
+#define VICII_STATE_VERSION 2
 
-// Must not exceed IPC_BUFSIZE
+// Dirty field groups
+//
+// Each side only writes fields that actually changed and marks them
+// dirty.  The other side only reads what is marked and then clears
+// the mask.  VICE owns vice_dirty and vice_reg_dirty (bit n set means
+// vice_reg[n] changed).  The simulator owns fpga_dirty and
+// fpga_reg_dirty.  A zero vice_dirty on a VICII_OP_SYNC_STATE request
+// means VICE does not track changes and everything should be applied.
+#define VICII_DIRTY_COUNTERS  1  // vc, vc_base, rc
+#define VICII_DIRTY_SPRITES   2  // mc, mcbase, ye_ff, xe_ff, sprite_dma
+#define VICII_DIRTY_CHAR_BUF  4  // char_buf/color_buf or fpga_char_buf
+#define VICII_DIRTY_FLAGS     8  // idle, bad line, irq, border, light pen
+#define VICII_DIRTY_ALL       0xffffffff
+
+// Must not exceed IPC_BUFSIZE.  Fields are ordered so there is no
+// interior padding and the ones touched on every exchange share the first
+// cache line.
 struct vicii_state {
+  unsigned short version; // VICII_STATE_VERSION
+  unsigned short size;    // sizeof(struct vicii_state)
   unsigned int flags;
   unsigned int enabled;
 
+  unsigned short addr_to_sim;
+  unsigned short data_to_sim;
+  unsigned short addr_from_sim;
+  unsigned short data_from_sim;
+
   unsigned char ce;
   unsigned char rw;
+  unsigned char lp;
   unsigned char phi;
   unsigned char ba;
+  unsigned char aec;
   unsigned char irq;
   unsigned char badline;
-  unsigned char char_buf[40]; // what's in the character buffer (char data)
-  unsigned int fpga_char_buf[40]; // what fpga thinks comparison in vice (both col and data)
-  unsigned char color_buf[40]; // what's in the character buffer (upper 4 bits color data)
-  unsigned char aec;
+
+  unsigned short cycle_num;  // for initial sync
+  unsigned short xpos;  // for initial sync
+  unsigned short raster_line;  // for initial sync
+  unsigned short pps;
+
+  unsigned char dot4x;
+  unsigned char cycleByCycleStepping;
   unsigned char idle;
   unsigned char allow_bad_lines;
   unsigned char reg11_delayed;
-  unsigned int raster_irq_triggered;
+  unsigned char raster_irq_triggered;
+  unsigned char light_pen_triggered;
+  unsigned char irst;
 
-  unsigned int irst;
-  unsigned int imbc;
-  unsigned int immc;
-  unsigned int ilp;
+  unsigned char imbc;
+  unsigned char immc;
+  unsigned char ilp;
+  unsigned char vborder;
+  unsigned char main_border;
+  unsigned char set_vborder;
+  unsigned short rc;
 
-  unsigned short addr_to_sim;
-  unsigned short data_to_sim;
+  unsigned short vc_base;
+  unsigned short vc;
 
-  unsigned short addr_from_sim;
-  unsigned short data_from_sim;
+  unsigned int vice_dirty;
+  unsigned int fpga_dirty;
+  unsigned long long vice_reg_dirty;
+  unsigned long long fpga_reg_dirty;
 
-  unsigned int cycle_num;  // for initial sync
-  unsigned int xpos;  // for initial sync
-  unsigned int raster_line;  // for initial sync
+  // Used to adjust our address on bmm transition glitch
+  unsigned short vice_vbank_phi1;
+  unsigned short vice_vbank_phi2;
 
   // registers for initial sync
   unsigned char vice_reg[64];
@@ -92,30 +141,15 @@ struct vicii_state {
   // registers for verification in vice after cycle step
   unsigned char fpga_reg[64];
 
-  unsigned int vc_base;
-  unsigned int vc;
-  unsigned int rc;
-
   unsigned char mc[8];
   unsigned char mcbase[8];
   unsigned char ye_ff[8];
   unsigned char xe_ff[8];
   unsigned char sprite_dma[8];
 
-  unsigned char vborder;
-  unsigned char main_border;
-  unsigned char set_vborder;
-
-  int cycleByCycleStepping;
-
-  int pps;
-  int dot4x;
-  unsigned char lp;
-  unsigned int light_pen_triggered;
-
-  // Used to adjust our address on bmm transition glitch
-  int vice_vbank_phi1;
-  int vice_vbank_phi2;
+  unsigned char char_buf[40]; // what's in the character buffer (char data)
+  unsigned char color_buf[40]; // what's in the character buffer (upper 4 bits color data)
+  unsigned short fpga_char_buf[40]; // what fpga thinks comparison in vice (both col and data)
 };
 
 #define END1_PRODUCER_SIG_END2_CONSUME_OK 0
@@ -128,6 +162,98 @@ struct vicii_state {
 
 #define IPC_BUFSIZE  1024
 
+#if defined(__linux__)
+#define IPC_USE_FUTEX 1
+#endif
+
+// Semaphores use the key, the shared memory segment key+1. Each
+// VICE/simulator pair needs its own key to run side by side.
+// VICII_IPC_KEY in the environment overrides the default.
+#define IPC_DEFAULT_KEY 1240
+
+#define IPC_MAGIC    0x56494332 // 'VIC2'
+#define IPC_VERSION  5
+
+// How many times to poll a semaphore before sleeping on it. Spinning
+// is skipped on single CPU machines where it would only delay the
+// other side.  VICII_IPC_SPIN in the environment overrides this.
+#define IPC_SPIN_COUNT 20000
+
+// Batched lockstep
+//
+// Instead of one exchange per step (4 dot4x ticks), VICE can run ahead
+// and queue up to IPC_BATCH_MAX steps of CPU bus activity along with
+// the outputs it expects from the VIC for each step.  It then sends a
+// single request with VICII_OP_BATCH set.  The simulator evaluates the
+// steps in order, records a compact digest of its outputs for each one
+// and compares it against VICE's expectation.  Evaluation stops at the
+// first step whose digest differs, leaving the model exactly at that
+// step.  VICE can then rewind to that step and continue in strict
+// lockstep to get the full half-cycle comparison.
+//
+// The full vicii_state is only refreshed at the end of the window.
+
+#define IPC_BATCH_MAX 4096
+
+// Step input, written by VICE
+struct vicii_batch_in {
+  unsigned short addr_to_sim;
+  unsigned short data_to_sim;
+  unsigned char ce;
+  unsigned char rw;
+  unsigned char lp;
+  unsigned char flags; // VICII_OP_BUS_ACCESS
+
+  // What VICE expects the VIC to produce at the end of this step
+  unsigned short expect_addr;
+  unsigned char expect_ba;
+  unsigned char expect_aec;
+  unsigned char expect_irq;
+  unsigned char pad[3];
+};
+
+// Step digest, written by the simulator
+struct vicii_batch_out {
+  unsigned short addr_from_sim;
+  unsigned short data_from_sim;
+  unsigned char ba;
+  unsigned char aec;
+  unsigned char irq;
+  unsigned char phi;
+};
+
+struct vicii_batch {
+  unsigned int count;  // steps queued by VICE
+  unsigned int done;   // steps evaluated by the simulator
+  int mismatch;        // first step that didn't match, -1 if none
+  unsigned int pad;
+  struct vicii_batch_in in[IPC_BATCH_MAX];
+  struct vicii_batch_out out[IPC_BATCH_MAX];
+};
+
+// One counting semaphore shared between both processes.
+struct vicii_ipc_sem {
+  volatile int count;
+  volatile int waiters;
+  // Keep each semaphore on its own cache line
+  char pad[56];
+};
+
+// Layout of the shared memory segment.  The state page follows the
+// header so both ends agree on where everything is.
+struct vicii_ipc_shm {
+  unsigned int magic;
+  unsigned int version;
+  // Progress published by VICE, see ipc_announce
+  volatile int vice_frame;
+  volatile int frame_waiters;
+  volatile unsigned long long vice_cycle;
+  char pad[40];
+  struct vicii_ipc_sem sems[4];
+  unsigned char buf[IPC_BUFSIZE];
+  struct vicii_batch batch;
+};
+
 struct vicii_ipc {
   int endPoint;
   int semsKey;
@@ -137,7 +263,10 @@ struct vicii_ipc {
   int bufKey;
   int bufShmId;
 
+  int spinCount;
+  struct vicii_ipc_shm* shm;
   struct vicii_state* state;
+  struct vicii_batch* batch;
 };
 
 // IPC_RECEIVER must init first
@@ -145,6 +274,11 @@ struct vicii_ipc {
 // IPC_RECEIVER receives a request and sends a response
 struct vicii_ipc* ipc_init(int endPoint);
 
+// Override the key picked by ipc_init. Must be called before ipc_open.
+void ipc_set_key(struct vicii_ipc* ipc, int key);
+
+// IPC_RECEIVER removes segments left behind by a previous session that
+// nobody is attached to anymore.
 int ipc_open(struct vicii_ipc* ipc);
 
 void ipc_close(struct vicii_ipc* ipc);
@@ -157,4 +291,15 @@ int ipc_receive(struct vicii_ipc* ipc);
 
 int ipc_receive_done(struct vicii_ipc* ipc);
 
+// Readiness
+//
+// VICE calls ipc_announce once per emulated frame (frames counted from
+// power on, starting at 1) so the other end can tell how far along it
+// is without a fixed sleep.  This never blocks.
+void ipc_announce(struct vicii_ipc* ipc, int frame, unsigned long long cycle);
+
+// Block until VICE has announced frame or later. Return 1 on timeout,
+// 0 when VICE is there.  timeoutMs <= 0 waits forever.
+int ipc_wait_frame(struct vicii_ipc* ipc, int frame, int timeoutMs);
+
 #endif
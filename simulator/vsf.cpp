@@ -0,0 +1,190 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+#include "log.h"
+#include "vsf.h"
+
+// File header: magic, major, minor, machine name
+#define VSF_MAGIC "VICE Snapshot File\032"
+#define VSF_MAGIC_LEN 19
+#define VSF_MACHINE_LEN 16
+#define VSF_HEADER_LEN (VSF_MAGIC_LEN + 2 + VSF_MACHINE_LEN)
+
+// Optional version block that follows it: magic, 4 version bytes, svn
+#define VSF_VERSION_MAGIC "VICE Version\032"
+#define VSF_VERSION_MAGIC_LEN 13
+#define VSF_VERSION_LEN (VSF_VERSION_MAGIC_LEN + 4 + 4)
+
+// Module header: name, major, minor, size (including this header)
+#define VSF_MODULE_NAME_LEN 16
+#define VSF_MODULE_HEADER_LEN (VSF_MODULE_NAME_LEN + 2 + 4)
+
+// C64MEM 0.x: pport data, dir, exrom, game, then RAM
+#define C64MEM_RAM 4
+
+// CIA 2.x: ora, orb, ddra, ddrb, ...
+#define CIA_ORA  0
+#define CIA_DDRA 2
+
+// x64sc VIC-II 1.1. Only the fields the model can take are listed.
+#define VIC2_REGS        0x001  // 64 bytes
+#define VIC2_CYCLE       0x041  // dword
+#define VIC2_LINE        0x049  // dword
+#define VIC2_IRQ_STATUS  0x04e  // byte, $d019 bits
+#define VIC2_VBUF        0x054  // 40 bytes
+#define VIC2_CBUF        0x07c  // 40 bytes
+#define VIC2_IDLE        0x2b9  // dword
+#define VIC2_VC          0x2bd  // dword
+#define VIC2_VCBASE      0x2c1  // dword
+#define VIC2_RC          0x2c5  // dword
+#define VIC2_COLOR_RAM   0x2f5  // 1024 bytes
+#define VIC2_SPRITES     0x6f5  // 8 x 12 bytes
+#define VIC2_MIN_SIZE    (VIC2_SPRITES + 8 * VIC2_SPRITE_SIZE)
+
+// Per sprite: data (dword), mc, mcbase, pointer, exp_flop, x (dword)
+#define VIC2_SPRITE_SIZE   12
+#define VIC2_SPRITE_MC     4
+#define VIC2_SPRITE_MCBASE 5
+#define VIC2_SPRITE_EXP    7
+
+struct vsf_module {
+  const uint8_t* data;
+  uint32_t size;
+  int major;
+  int minor;
+};
+
+static uint32_t get_dw(const uint8_t* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+// Find module name. Returns 1 if it isn't there.
+static int find_module(const std::vector<uint8_t>& file, size_t start,
+                       const char* name, struct vsf_module* mod) {
+  size_t off = start;
+  while (off + VSF_MODULE_HEADER_LEN <= file.size()) {
+     const uint8_t* hdr = &file[off];
+     uint32_t size = get_dw(hdr + VSF_MODULE_NAME_LEN + 2);
+     if (size < VSF_MODULE_HEADER_LEN || off + size > file.size())
+        break;
+     if (strncmp((const char*) hdr, name, VSF_MODULE_NAME_LEN) == 0) {
+        mod->data = hdr + VSF_MODULE_HEADER_LEN;
+        mod->size = size - VSF_MODULE_HEADER_LEN;
+        mod->major = hdr[VSF_MODULE_NAME_LEN];
+        mod->minor = hdr[VSF_MODULE_NAME_LEN + 1];
+        return 0;
+     }
+     off += size;
+  }
+  return 1;
+}
+
+int vsf_load(const char* filename, struct vicii_state* state,
+             struct busmodel* bus) {
+  FILE* fp = fopen(filename, "rb");
+  if (fp == nullptr) {
+     LOG(LOG_ERROR, "can't open %s", filename);
+     return 1;
+  }
+  std::vector<uint8_t> file;
+  uint8_t buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+     file.insert(file.end(), buf, buf + n);
+  fclose(fp);
+
+  if (file.size() < VSF_HEADER_LEN ||
+         memcmp(&file[0], VSF_MAGIC, VSF_MAGIC_LEN) != 0) {
+     LOG(LOG_ERROR, "%s is not a VICE snapshot", filename);
+     return 1;
+  }
+
+  size_t start = VSF_HEADER_LEN;
+  if (file.size() >= start + VSF_VERSION_LEN &&
+         memcmp(&file[start], VSF_VERSION_MAGIC, VSF_VERSION_MAGIC_LEN) == 0)
+     start += VSF_VERSION_LEN;
+
+  struct vsf_module vic, mem, cia2;
+  if (find_module(file, start, "VIC-II", &vic) ||
+      find_module(file, start, "C64MEM", &mem) ||
+      find_module(file, start, "CIA2", &cia2)) {
+     LOG(LOG_ERROR, "%s needs VIC-II, C64MEM and CIA2 modules", filename);
+     return 1;
+  }
+
+  if (vic.major != 1 || vic.minor != 1 || vic.size < VIC2_MIN_SIZE) {
+     LOG(LOG_ERROR, "%s: unsupported VIC-II module %d.%d (need x64sc 1.1)",
+         filename, vic.major, vic.minor);
+     return 1;
+  }
+  if (mem.size < C64MEM_RAM + BUS_RAM_SIZE || cia2.size < CIA_DDRA + 1) {
+     LOG(LOG_ERROR, "%s: short C64MEM or CIA2 module", filename);
+     return 1;
+  }
+
+  const uint8_t* v = vic.data;
+
+  memcpy(state->vice_reg, v + VIC2_REGS, 64);
+  state->cycle_num = get_dw(v + VIC2_CYCLE);
+  state->raster_line = get_dw(v + VIC2_LINE);
+
+  uint8_t irq = v[VIC2_IRQ_STATUS];
+  state->irst = irq & 1 ? 1 : 0;
+  state->imbc = irq & 2 ? 1 : 0;
+  state->immc = irq & 4 ? 1 : 0;
+  state->ilp = irq & 8 ? 1 : 0;
+
+  state->idle = get_dw(v + VIC2_IDLE) ? 1 : 0;
+  state->vc = get_dw(v + VIC2_VC);
+  state->vc_base = get_dw(v + VIC2_VCBASE);
+  state->rc = get_dw(v + VIC2_RC);
+
+  for (int i = 0; i < 40; i++) {
+     state->char_buf[i] = v[VIC2_VBUF + i];
+     state->color_buf[i] = v[VIC2_CBUF + i] & 0xf;
+  }
+
+  for (int s = 0; s < 8; s++) {
+     const uint8_t* sp = v + VIC2_SPRITES + s * VIC2_SPRITE_SIZE;
+     state->mc[s] = sp[VIC2_SPRITE_MC];
+     state->mcbase[s] = sp[VIC2_SPRITE_MCBASE];
+     state->ye_ff[s] = sp[VIC2_SPRITE_EXP];
+     state->sprite_dma[s] = 0;
+  }
+
+  // Port A bits 0-1 select the bank inverted. Inputs are pulled up.
+  int pa = cia2.data[CIA_ORA] | ~cia2.data[CIA_DDRA];
+  int bank = 3 - (pa & 3);
+  state->vice_vbank_phi1 = bank * 0x4000;
+  state->vice_vbank_phi2 = bank * 0x4000;
+
+  // VICE isn't tracking changes, take everything.
+  state->vice_dirty = 0;
+  state->vice_reg_dirty = 0;
+
+  memcpy(bus->ram, mem.data + C64MEM_RAM, BUS_RAM_SIZE);
+  memcpy(bus->color, v + VIC2_COLOR_RAM, BUS_COLOR_SIZE);
+  bus_set_bank(bus, bank);
+
+  LOG(LOG_INFO, "%s: line %d cycle %d bank %d", filename,
+      state->raster_line, state->cycle_num, bank);
+  return 0;
+}
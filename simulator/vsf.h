@@ -0,0 +1,40 @@
+// This file is part of the vicii-kawari distribution
+// (https://github.com/randyrossi/vicii-kawari)
+// Copyright (c) 2022 Randy Rossi.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, version 3.
+//
+// This program is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef VICII_VSF_H
+#define VICII_VSF_H
+
+#include "busmodel.h"
+
+extern "C" {
+#include "vicii_ipc.h"
+}
+
+// Loads a VICE (x64sc) .vsf snapshot without VICE.
+//
+// The VIC-II module fills in the same vicii_state fields VICE hands
+// over for VICII_OP_SYNC_STATE (registers, raster position, vc, vcbase,
+// rc, idle, interrupt flags, sprite mc/mcbase/y expansion and the char
+// buffer) so the model can be seeded through regs_vice_to_fpga. C64MEM
+// RAM, the VIC-II module's color RAM and the CIA2 bank go into bus.
+//
+// VICE does not store ROMs in snapshots. Load the char ROM separately.
+//
+// Returns 1 on error, 0 success.
+int vsf_load(const char* filename, struct vicii_state* state,
+             struct busmodel* bus);
+
+#endif
@@ -19,9 +19,24 @@ public class MakeReport
 		String d = l.substring(0,i);
 		String fn = l.substring(i+1);
 
+		// Status from regress.sh, if it ran this one
+		String status = "";
+		File rf = new File(d+"/result_"+fn+".json");
+		if (rf.exists()) {
+		   BufferedReader rr = new BufferedReader(new FileReader(rf));
+		   while (true) {
+		      String l3 = rr.readLine();
+		      if (l3 == null) break;
+		      l3 = l3.trim();
+		      if (l3.startsWith("\"status\":"))
+		         status = " " + l3.substring(9).replaceAll("[\" ,]", "");
+		   }
+		   rr.close();
+		}
+
 		System.out.println("<tr>");
 		System.out.println("<td>");
-		System.out.println(l);
+		System.out.println(l + status);
 		System.out.println("</td>");
 		System.out.println("</tr>");
 
@@ -32,6 +47,11 @@ public class MakeReport
 		System.out.println("<td>");
 		System.out.println("<a target=_blank href=\""+web_dir+"/fpga_"+fn+".png\"><img src=\""+web_dir+"/fpga_"+fn+".png\"></img></a>");
 		System.out.println("</td>");
+		if (new File(d+"/diff_"+fn+".png").exists()) {
+		   System.out.println("<td>");
+		   System.out.println("<a target=_blank href=\""+web_dir+"/diff_"+fn+".png\"><img src=\""+web_dir+"/diff_"+fn+".png\"></img></a>");
+		   System.out.println("</td>");
+		}
 		System.out.println("<td>");
 		System.out.println("<textarea rows=\"10\" cols=\"50\">");
 
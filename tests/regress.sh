@@ -0,0 +1,239 @@
+#!/bin/bash
+# Usage
+# ./regress.sh [-j jobs] [-f] [pattern]
+#
+# Like test_parallel.sh but only runs tests whose inputs changed since
+# their last run. A test's key hashes the simulator binary, the files
+# it is built from (make sources), config.vh, run_test.sh, the standard
+# and the PRG/VSF itself. Each run leaves result_<prg>.json next to its
+# fpga_<prg>.png. A test is skipped while its result has the same key
+# and the FPGA frame on disk still has the recorded hash. A skipped
+# test that didn't pass still counts as failed.
+#
+# The rest are handed to jobs workers (default: number of cores) as
+# they free up. Each worker gets its own IPC key and VICE work dir.
+#
+#   -f       ignore cached results
+#   pattern  only tests whose path matches (grep -E)
+#
+# Rebuild the simulator (make test_suite) before running. With
+# ../simulator/framecmp built (make framecmp), screenshot tests whose
+# frame differs from VICE's fail and leave a diff_<prg>.png heatmap.
+#
+# VICSIM (see run_test.sh) runs a config_build binary instead (make -C
+# ../simulator config_test_11). That binary and its own config.vh go
+# into the key.
+
+jobs=`nproc`
+force=0
+while getopts "j:f" opt
+do
+   case $opt in
+      j) jobs=$OPTARG ;;
+      f) force=1 ;;
+      *) exit 1 ;;
+   esac
+done
+shift $((OPTIND - 1))
+pattern=${1:-.}
+
+base_key=${VICII_IPC_KEY_BASE:-2000}
+work_root=${WORK_ROOT:-/tmp/vicii-tests}
+
+input="tests.txt"
+
+mkdir -p $work_root
+rm -f $work_root/*.log $work_root/*.status $work_root/queue \
+   $work_root/next $work_root/lock
+
+# Everything the simulator's output depends on
+vicsim=${VICSIM:-../simulator/obj_dir/Vtop}
+sources=`make -s -C ../simulator sources | sed -n 's/^SOURCES: //p'`
+if [ -z "$sources" ]
+then
+   echo "can't get the source list from ../simulator/Makefile"
+   exit 1
+fi
+# A config_build dir (see VICSIM in run_test.sh) has its own config.vh
+config=../hdl/config.vh
+if [ -n "$VICSIM" ] && [ -f `dirname $VICSIM`/include/config.vh ]
+then
+   config=`dirname $VICSIM`/include/config.vh
+fi
+build_hash=`(
+   sha256sum $vicsim 2> /dev/null || echo "missing $vicsim"
+   sha256sum $config 2> /dev/null || echo "missing $config"
+   cd ../simulator
+   for f in $sources
+   do
+      sha256sum $f 2> /dev/null || echo "missing $f"
+   done
+   sha256sum ../tests/run_test.sh
+) | sha256sum | cut -c1-16`
+
+echo "build $build_hash"
+
+# value of "field" in one of our result files
+json_field() {
+   sed -n "s/^  \"$2\": \"\{0,1\}\([^\",]*\)\"\{0,1\},\{0,1\}$/\1/p" $1
+}
+
+test_key() {
+   prg_hash=`sha256sum $1 2> /dev/null | cut -c1-64`
+   echo "$build_hash $2 $prg_hash" | sha256sum | cut -c1-16
+}
+
+cached=0
+cached_failed=0
+queued=0
+while read -r prg standard kind
+do
+   echo $prg | grep -qE "$pattern" || continue
+
+   j=`basename $prg`
+   k=`dirname $prg`
+   result=$k/result_$j.json
+   fpga=$k/fpga_$j.png
+   key=`test_key $prg $standard`
+
+   if [ $force -eq 0 ] && [ -f $result ] && [ -f $fpga ] &&
+      [ "`json_field $result key`" == "$key" ] &&
+      [ "`json_field $result fpga_hash`" == "`sha256sum $fpga | cut -c1-64`" ]
+   then
+      cached=$((cached + 1))
+      # Still counts against the run until its inputs change
+      status=`json_field $result status`
+      if [ "$status" != "pass" ]
+      then
+         echo "$status $prg (cached)"
+         cached_failed=$((cached_failed + 1))
+      fi
+      continue
+   fi
+
+   echo "$prg $standard $kind $key" >> $work_root/queue
+   queued=$((queued + 1))
+done < "$input"
+
+echo "$cached cached, $queued to run on $jobs workers"
+
+echo 0 > $work_root/next
+touch $work_root/queue
+
+# Next queued line, empty once the queue is drained
+next_test() {
+   (
+      flock 9
+      n=`cat $work_root/next`
+      echo $((n + 1)) > $work_root/next
+      sed -n "$((n + 1))p" $work_root/queue
+   ) 9> $work_root/lock
+}
+
+run_one() {
+   prg=$1
+   standard=$2
+   kind=$3
+   key=$4
+   j=`basename $prg`
+   k=`dirname $prg`
+   fpga=$k/fpga_$j.png
+
+   rm -f $fpga
+   start=`date +%s`
+   ./run_test.sh $prg $standard
+   rc=$?
+   secs=$((`date +%s` - start))
+
+   fpga_hash=""
+   if [ -f $fpga ]
+   then
+      fpga_hash=`sha256sum $fpga | cut -c1-64`
+   fi
+   vice_hash=""
+   if [ -f $k/vice_$j.png ]
+   then
+      vice_hash=`sha256sum $k/vice_$j.png | cut -c1-64`
+   fi
+
+   status="pass"
+   if [ $rc -ne 0 ]
+   then
+      status="fail"
+   elif [ -z "$fpga_hash" ]
+   then
+      status="error"
+   fi
+
+   # -1 when not compared
+   mismatches=-1
+   rm -f $k/diff_$j.png
+   if [ -x ../simulator/framecmp ] && [ "$kind" == "screenshot" ] &&
+      [ -n "$fpga_hash" ] && [ -n "$vice_hash" ]
+   then
+      mismatches=`../simulator/framecmp -j $fpga $k/vice_$j.png |
+         sed -n 's/.*"mismatches": \([0-9]*\).*/\1/p'`
+      mismatches=${mismatches:--1}
+      if [ $mismatches -gt 0 ]
+      then
+         ../simulator/framecmp -d $k/diff_$j.png $fpga $k/vice_$j.png
+         [ $status == "pass" ] && status="differ"
+      fi
+   fi
+
+   cat > $k/result_$j.json << EOF
+{
+  "test": "$prg",
+  "standard": "$standard",
+  "kind": "$kind",
+  "key": "$key",
+  "build": "$build_hash",
+  "status": "$status",
+  "exit_code": $rc,
+  "seconds": $secs,
+  "fpga_hash": "$fpga_hash",
+  "vice_hash": "$vice_hash",
+  "mismatches": $mismatches,
+  "date": "`date -u +%Y-%m-%dT%H:%M:%SZ`"
+}
+EOF
+   echo "$status $prg (${secs}s)"
+}
+
+for ((w=0; w<jobs; w++))
+do
+   (
+      export VICII_IPC_KEY=$((base_key + w * 2))
+      export WORKDIR=$work_root/$w
+      while true
+      do
+         read -r prg standard kind key <<< "`next_test`"
+         [ -z "$prg" ] && break
+         run_one "$prg" "$standard" "$kind" "$key" >> $work_root/$w.log 2>&1
+         tail -1 $work_root/$w.log | tee -a $work_root/$w.status
+      done
+   ) &
+done
+
+wait
+
+# All results, cached or not, in one file for the report
+(
+   echo "["
+   sep=""
+   while read -r prg standard kind
+   do
+      echo $prg | grep -qE "$pattern" || continue
+      result=`dirname $prg`/result_`basename $prg`.json
+      [ -f $result ] || continue
+      printf "$sep"
+      cat $result
+      sep=","
+   done < "$input"
+   echo "]"
+) > results.json
+
+failed=`cat $work_root/*.status 2> /dev/null | grep -vc "^pass "`
+failed=$((failed + cached_failed))
+echo "$queued ran, $cached cached, $failed failed. See results.json"
+[ $failed -eq 0 ]
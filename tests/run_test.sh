@@ -0,0 +1,95 @@
+#!/bin/bash
+# Usage
+# ./run_test.sh <prg> <PAL|NTSC|NTSCOLD>
+#
+# Runs one test from tests.txt through VICE and the simulator.
+#
+# VICII_IPC_KEY selects the IPC key both ends use so several of these
+# can run at once (see test_parallel.sh). VICE is started from WORKDIR
+# (default: the VICE tree) which is where it leaves screenshot.png.
+# VICSIM picks the simulator binary, e.g. the fast regression profile:
+#   VICSIM=../simulator/obj_dir_cfg11_pal29MHZ_ntsc26MHZ/Vtop
+
+VICII_PARENT=${VICII_PARENT:-/shared/Vivado}
+VICE_DIR=${VICII_PARENT}/vicii-vice-3.4
+WORKDIR=${WORKDIR:-$VICE_DIR}
+VICSIM=${VICSIM:-../simulator/obj_dir/Vtop}
+
+i=$1
+
+j=`basename $i`
+k=`dirname $i`
+
+if [ "$2" == "NTSC" ]
+then
+	standard="-ntsc"
+	model="6567"
+	chip="0"
+	rate="60"
+elif [ "$2" == "NTSCOLD" ]
+then
+	standard="-ntsc"
+	model="6567r56a"
+	chip="2"
+	rate="60"
+else
+	standard="-pal"
+	model="6569"
+	chip="1"
+	rate="50"
+fi
+
+# How many seconds of emulated time VICE needs before the test
+# screen is up. The simulator waits for VICE to announce that frame
+# so VICE can run in warp mode instead of us sleeping. A VICE that
+# doesn't announce frames gets the same number of real seconds.
+settle="6"
+if [[ $i == +(*spritecrunch*) ]]
+then
+	settle="8"
+elif [[ $i == +(*reg_timing*) ]]
+then
+	settle="14"
+elif [[ $i == +(*lightpen*) ]]
+then
+	settle="16"
+elif [[ $i == +(*lft-safe-vsp*) ]]
+then
+	settle="19"
+elif [[ $i == +(*spritescan*) ]]
+then
+	settle="19"
+elif [[ $i == +(*sprite0move*) ]]
+then
+	settle="19"
+elif [[ $i == +(*spritevssprite*) ]]
+then
+	settle="19"
+fi
+frames=$((settle * rate))
+
+# The simulator owns the IPC segment so it has to start first.
+$VICSIM -k -q --headless -z -x -c $chip \
+	--wait-frame $frames -o $k/fpga_$j.png &
+sim=$!
+
+mkdir -p $WORKDIR
+pushd $WORKDIR > /dev/null
+${VICE_DIR}/src/x64sc -sounddev dummy -warp $standard -VICIImodel $model \
+	"${VICII_PARENT}/vicii-kawari/tests/$i" 2> stderr &
+vice=$!
+popd > /dev/null
+
+# VICE exits on its own once the capture is done
+wait $sim
+status=$?
+if [ $status -ne 0 ]
+then
+	kill $vice 2> /dev/null
+fi
+wait $vice
+
+mv $WORKDIR/stderr $k/vice_$j.log
+mv $WORKDIR/screenshot.png $k/vice_$j.png
+
+exit $status
@@ -0,0 +1,37 @@
+#!/bin/bash
+# Usage
+# ./test_parallel.sh [jobs]
+#
+# Same as test_all.sh but shards tests.txt across jobs workers
+# (default: number of cores). Each worker gets its own IPC key and
+# VICE work dir so the VICE/simulator pairs don't see each other.
+
+jobs=${1:-`nproc`}
+base_key=${VICII_IPC_KEY_BASE:-2000}
+work_root=${WORK_ROOT:-/tmp/vicii-tests}
+
+input="tests.txt"
+
+mkdir -p $work_root
+rm -f $work_root/*.log
+
+for ((w=0; w<jobs; w++))
+do
+   (
+      export VICII_IPC_KEY=$((base_key + w * 2))
+      export WORKDIR=$work_root/$w
+      n=0
+      while read -r line
+      do
+         if [ $((n % jobs)) -eq $w ]
+         then
+            stringarray=($line)
+            ./run_test.sh ${stringarray[0]} ${stringarray[1]} \
+               >> $work_root/$w.log 2>&1
+         fi
+         n=$((n + 1))
+      done < "$input"
+   ) &
+done
+
+wait